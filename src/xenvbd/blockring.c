@@ -37,11 +37,17 @@
 #include "debug.h"
 #include "srbext.h"
 #include "driver.h"
+#include "etw.h"
+#include "histogram.h"
+#include "profile.h"
 #include <stdlib.h>
 #include <xenvbd-ntstrsafe.h>
 
 #define TAG_HEADER                  'gaTX'
 
+// Occupancy is recorded in eighths of the ring, the last bucket is full
+#define BLOCKRING_OCCUPANCY_BUCKETS 9
+
 struct _XENVBD_BLOCKRING {
     PXENVBD_FRONTEND                Frontend;
     BOOLEAN                         Connected;
@@ -55,11 +61,37 @@ struct _XENVBD_BLOCKRING {
     blkif_front_ring_t              FrontRing;
     ULONG                           DeviceId;
     ULONG                           Order;
+    ULONG                           NextOrder;  // adaptive policy, from the last connect
     PVOID                           Grants[XENVBD_MAX_RING_PAGES];
     ULONG                           Submitted;
     ULONG                           Received;
+    LONG                            Completing;
+
+    // Telemetry, updated under Lock. Occupancy is time-weighted: the
+    // time spent at each level of outstanding requests, in ticks
+    ULONG64                         Occupancy[BLOCKRING_OCCUPANCY_BUCKETS];
+    ULONG64                         SampleTime;
+    ULONG                           Outstanding;
+    ULONG64                         FullEpisodes;
+    ULONG64                         FullTicks;
+    ULONG64                         FullMaxTicks;
+    ULONG64                         FullSince;
+
+    // Occupancy when the ring was connected, for the load seen since
+    ULONG64                         OccupancyBase[BLOCKRING_OCCUPANCY_BUCKETS];
+    // Most requests outstanding at once since the ring was connected
+    ULONG                           Peak;
 };
 
+// Responses are harvested under the lock in batches of this size and
+// completed after it has been dropped
+#define BLOCKRING_POLL_BATCH        32
+
+typedef struct _XENVBD_RESPONSE {
+    ULONG                           Tag;
+    SHORT                           Status;
+} XENVBD_RESPONSE, *PXENVBD_RESPONSE;
+
 #define MAX_NAME_LEN                64
 #define BLOCKRING_POOL_TAG          'gnRX'
 
@@ -236,6 +268,74 @@ __BlockRingInsert(
     ++BlockRing->Submitted;
 }
 
+static FORCEINLINE ULONG
+__BlockRingOccupancyBucket(
+    IN  PXENVBD_BLOCKRING           BlockRing,
+    IN  ULONG                       Outstanding
+    )
+{
+    ULONG   Size = RING_SIZE(&BlockRing->FrontRing);
+
+    if (Size == 0)
+        return 0;
+    if (Outstanding >= Size)
+        return BLOCKRING_OCCUPANCY_BUCKETS - 1;
+    return (Outstanding * (BLOCKRING_OCCUPANCY_BUCKETS - 1)) / Size;
+}
+
+static FORCEINLINE VOID
+__BlockRingSample(
+    IN  PXENVBD_BLOCKRING           BlockRing,
+    IN  ULONG64                     Now
+    )
+{
+    // Now may have been taken before Lock, so can trail SampleTime
+    if (BlockRing->SampleTime != 0) {
+        if (Now <= BlockRing->SampleTime)
+            Now = BlockRing->SampleTime;
+        else
+            BlockRing->Occupancy[__BlockRingOccupancyBucket(BlockRing, BlockRing->Outstanding)] +=
+                    Now - BlockRing->SampleTime;
+    }
+
+    BlockRing->SampleTime = Now;
+    BlockRing->Outstanding = BlockRing->FrontRing.req_prod_pvt -
+                             BlockRing->FrontRing.rsp_cons;
+    if (BlockRing->Outstanding > BlockRing->Peak)
+        BlockRing->Peak = BlockRing->Outstanding;
+}
+
+static FORCEINLINE VOID
+__BlockRingFullBegin(
+    IN  PXENVBD_BLOCKRING           BlockRing,
+    IN  ULONG64                     Now
+    )
+{
+    if (BlockRing->FullSince != 0)
+        return;
+
+    BlockRing->FullSince = Now;
+    ++BlockRing->FullEpisodes;
+}
+
+static FORCEINLINE VOID
+__BlockRingFullEnd(
+    IN  PXENVBD_BLOCKRING           BlockRing,
+    IN  ULONG64                     Now
+    )
+{
+    ULONG64 Ticks;
+
+    if (BlockRing->FullSince == 0)
+        return;
+
+    Ticks = (Now > BlockRing->FullSince) ? Now - BlockRing->FullSince : 0;
+    BlockRing->FullTicks += Ticks;
+    if (Ticks > BlockRing->FullMaxTicks)
+        BlockRing->FullMaxTicks = Ticks;
+    BlockRing->FullSince = 0;
+}
+
 NTSTATUS
 BlockRingCreate(
     IN  PXENVBD_FRONTEND            Frontend,
@@ -249,6 +349,7 @@ BlockRingCreate(
 
     (*BlockRing)->Frontend = Frontend;
     (*BlockRing)->DeviceId = DeviceId;
+    (*BlockRing)->NextOrder = DriverParameters.RingPageOrder;
     KeInitializeSpinLock(&(*BlockRing)->Lock);
 
     return STATUS_SUCCESS;
@@ -264,6 +365,15 @@ BlockRingDestroy(
 {
     BlockRing->Frontend = NULL;
     BlockRing->DeviceId = 0;
+    BlockRing->NextOrder = 0;
+    BlockRing->Peak = 0;
+    RtlZeroMemory(&BlockRing->OccupancyBase, sizeof(BlockRing->OccupancyBase));
+    BlockRing->FullSince = 0;
+    BlockRing->FullMaxTicks = 0;
+    BlockRing->FullTicks = 0;
+    BlockRing->FullEpisodes = 0;
+    BlockRing->Outstanding = 0;
+    RtlZeroMemory(&BlockRing->Occupancy, sizeof(BlockRing->Occupancy));
     RtlZeroMemory(&BlockRing->Lock, sizeof(KSPIN_LOCK));
     
     ASSERT(IsZeroMemory(BlockRing, sizeof(XENVBD_BLOCKRING)));
@@ -271,6 +381,81 @@ BlockRingDestroy(
     __BlockRingFree(BlockRing);
 }
 
+static ULONG
+__BlockRingPolicyOrder(
+    IN  PXENVBD_BLOCKRING           BlockRing,
+    IN  ULONG                       MaxOrder
+    )
+{
+    NTSTATUS        status;
+    PCHAR           Value;
+    ULONG           Order;
+
+    // the toolstack knows best which disks are busy
+    status = FrontendStoreReadFrontend(BlockRing->Frontend, "ring-page-order-hint", &Value);
+    if (NT_SUCCESS(status)) {
+        Order = strtoul(Value, NULL, 10);
+        FrontendStoreFree(BlockRing->Frontend, Value);
+        return __min(Order, MaxOrder);
+    }
+
+    switch (DriverParameters.RingPolicy) {
+    case XENVBD_RING_POLICY_FIXED:
+        Order = DriverParameters.RingPageOrder;
+        break;
+    case XENVBD_RING_POLICY_ADAPTIVE:
+        Order = BlockRing->NextOrder;
+        break;
+    case XENVBD_RING_POLICY_MAX:
+    default:
+        Order = MaxOrder;
+        break;
+    }
+
+    return __min(Order, MaxOrder);
+}
+
+static VOID
+__BlockRingAdapt(
+    IN  PXENVBD_BLOCKRING           BlockRing
+    )
+{
+    ULONG   Size = RING_SIZE(&BlockRing->FrontRing);
+    ULONG64 Total = 0;
+    ULONG64 Busy;
+    ULONG   Index;
+
+    for (Index = 0; Index < BLOCKRING_OCCUPANCY_BUCKETS; ++Index)
+        Total += BlockRing->Occupancy[Index] - BlockRing->OccupancyBase[Index];
+
+    Busy = BlockRing->Occupancy[BLOCKRING_OCCUPANCY_BUCKETS - 1] -
+           BlockRing->OccupancyBase[BLOCKRING_OCCUPANCY_BUCKETS - 1] +
+           BlockRing->Occupancy[BLOCKRING_OCCUPANCY_BUCKETS - 2] -
+           BlockRing->OccupancyBase[BLOCKRING_OCCUPANCY_BUCKETS - 2];
+
+    // Grow if over 7/8 of the ring was in use for more than a tenth of the
+    // time. Shrink only if it never got to half full, so the half sized
+    // ring would have held every request; a share of the time idle says
+    // nothing about the bursts a ring exists to absorb
+    BlockRing->NextOrder = BlockRing->Order;
+    if (Busy * 10 > Total && Total != 0) {
+        if (BlockRing->Order < XENVBD_MAX_RING_PAGE_ORDER)
+            BlockRing->NextOrder = BlockRing->Order + 1;
+    } else if (BlockRing->Peak * 2 < Size) {
+        if (BlockRing->Order > 0)
+            BlockRing->NextOrder = BlockRing->Order - 1;
+    }
+
+    if (BlockRing->NextOrder != BlockRing->Order)
+        Verbose("Target[%d] : ring-page-order %u -> %u (busy %llu%%, peak %u/%u)\n",
+                FrontendGetTargetId(BlockRing->Frontend),
+                BlockRing->Order,
+                BlockRing->NextOrder,
+                Total ? (Busy * 100) / Total : 0,
+                BlockRing->Peak,
+                Size);
+}
+
 NTSTATUS
 BlockRingConnect(
     IN  PXENVBD_BLOCKRING           BlockRing
@@ -279,6 +464,7 @@ BlockRingConnect(
     NTSTATUS        status;
     PCHAR           Value;
     ULONG           Index, RingPages;
+    ULONG           MaxOrder;
     PXENVBD_FDO     Fdo = PdoGetFdo(FrontendGetPdo(BlockRing->Frontend));
     PXENVBD_GRANTER Granter = FrontendGetGranter(BlockRing->Frontend);
 
@@ -292,14 +478,19 @@ BlockRingConnect(
 
     status = FrontendStoreReadBackend(BlockRing->Frontend, "max-ring-page-order", &Value);
     if (NT_SUCCESS(status)) {
-        BlockRing->Order = __min(strtoul(Value, NULL, 10), XENVBD_MAX_RING_PAGE_ORDER);
+        MaxOrder = __min(strtoul(Value, NULL, 10), XENVBD_MAX_RING_PAGE_ORDER);
         FrontendStoreFree(BlockRing->Frontend, Value);
     } else {
-        BlockRing->Order = 0;
+        MaxOrder = 0;
     }
 
+    BlockRing->Order = __BlockRingPolicyOrder(BlockRing, MaxOrder);
+    BlockRing->Order = FdoAcquireRingPages(Fdo, BlockRing->Order);
+
     status = STATUS_NO_MEMORY;
-    BlockRing->SharedRing = __AllocPages((SIZE_T)PAGE_SIZE << BlockRing->Order, &BlockRing->Mdl);
+    BlockRing->SharedRing = __AllocNodePages((SIZE_T)PAGE_SIZE << BlockRing->Order,
+                                             FrontendGetPlacement(BlockRing->Frontend)->Node,
+                                             &BlockRing->Mdl);
     if (BlockRing->SharedRing == NULL)
         goto fail2;
 
@@ -318,6 +509,11 @@ BlockRingConnect(
             goto fail3;
     }
 
+    RtlCopyMemory(BlockRing->OccupancyBase,
+                  BlockRing->Occupancy,
+                  sizeof(BlockRing->Occupancy));
+    BlockRing->Peak = 0;
+
     BlockRing->Connected = TRUE;
     return STATUS_SUCCESS;
 
@@ -334,6 +530,8 @@ fail3:
     BlockRing->Mdl = NULL;
 
 fail2:
+    FdoReleaseRingPages(Fdo, BlockRing->Order);
+    BlockRing->Order = 0;
 fail1:
     return status;
 }
@@ -416,9 +614,25 @@ BlockRingDisable(
     IN  PXENVBD_BLOCKRING           BlockRing
     )
 {
+    KIRQL   Irql;
+
     ASSERT(BlockRing->Enabled == TRUE);
 
+    KeAcquireSpinLock(&BlockRing->Lock, &Irql);
     BlockRing->Enabled = FALSE;
+
+    // close the current occupancy sample and any ring-full episode, time
+    // spent disabled is not attributed to either
+    __BlockRingSample(BlockRing, HistogramNow());
+    __BlockRingFullEnd(BlockRing, BlockRing->SampleTime);
+    BlockRing->SampleTime = 0;
+    KeReleaseSpinLock(&BlockRing->Lock, Irql);
+
+    // wait for responses harvested before the ring was disabled
+    while (BlockRing->Completing != 0) {
+        YieldProcessor();
+        KeMemoryBarrier();
+    }
 }
 
 VOID
@@ -431,6 +645,10 @@ BlockRingDisconnect(
 
     ASSERT(BlockRing->Connected == TRUE);
 
+    // before FrontRing is cleared, __BlockRingAdapt needs its size
+    if (DriverParameters.RingPolicy == XENVBD_RING_POLICY_ADAPTIVE)
+        __BlockRingAdapt(BlockRing);
+
     BlockRing->Submitted = 0;
     BlockRing->Received = 0;
 
@@ -446,6 +664,8 @@ BlockRingDisconnect(
     BlockRing->SharedRing = NULL;
     BlockRing->Mdl = NULL;
 
+    FdoReleaseRingPages(PdoGetFdo(FrontendGetPdo(BlockRing->Frontend)),
+                        BlockRing->Order);
     BlockRing->Order = 0;
 
     XENBUS_STORE(Release, BlockRing->StoreInterface);
@@ -454,6 +674,50 @@ BlockRingDisconnect(
     BlockRing->Connected = FALSE;
 }
 
+static VOID
+__BlockRingTelemetryDebug(
+    IN  PXENVBD_BLOCKRING           BlockRing,
+    IN  PXENBUS_DEBUG_INTERFACE     Debug
+    )
+{
+    ULONG64 Total = 0;
+    ULONG   Index;
+
+    XENBUS_DEBUG(Printf, Debug,
+                 "BLOCKRING: RingFull   : %llu episodes, %lluus total, %lluus max%s\n",
+                 BlockRing->FullEpisodes,
+                 HistogramTicksToUs(BlockRing->FullTicks),
+                 HistogramTicksToUs(BlockRing->FullMaxTicks),
+                 BlockRing->FullSince ? " (full now)" : "");
+    XENBUS_DEBUG(Printf, Debug,
+                 "BLOCKRING: Peak       : %u / %u\n",
+                 BlockRing->Peak,
+                 RING_SIZE(&BlockRing->FrontRing));
+
+    for (Index = 0; Index < BLOCKRING_OCCUPANCY_BUCKETS; ++Index)
+        Total += BlockRing->Occupancy[Index];
+    if (Total == 0)
+        return;
+
+    for (Index = 0; Index < BLOCKRING_OCCUPANCY_BUCKETS; ++Index) {
+        if (BlockRing->Occupancy[Index] == 0)
+            continue;
+
+        if (Index == BLOCKRING_OCCUPANCY_BUCKETS - 1)
+            XENBUS_DEBUG(Printf, Debug,
+                         "BLOCKRING: Occupancy  : full : %lluus (%llu%%)\n",
+                         HistogramTicksToUs(BlockRing->Occupancy[Index]),
+                         (BlockRing->Occupancy[Index] * 100) / Total);
+        else
+            XENBUS_DEBUG(Printf, Debug,
+                         "BLOCKRING: Occupancy  : <%u/%u : %lluus (%llu%%)\n",
+                         Index + 1,
+                         BLOCKRING_OCCUPANCY_BUCKETS - 1,
+                         HistogramTicksToUs(BlockRing->Occupancy[Index]),
+                         (BlockRing->Occupancy[Index] * 100) / Total);
+    }
+}
+
 VOID
 BlockRingDebugCallback(
     IN  PXENVBD_BLOCKRING           BlockRing,
@@ -487,9 +751,12 @@ BlockRingDebugCallback(
                  BlockRing->FrontRing.rsp_cons,
                  BlockRing->FrontRing.nr_ents);
 
+    __BlockRingTelemetryDebug(BlockRing, Debug);
+
     XENBUS_DEBUG(Printf, Debug,
-                 "BLOCKRING: Order      : %d\n",
-                 BlockRing->Order);
+                 "BLOCKRING: Order      : %d (next %u)\n",
+                 BlockRing->Order,
+                 BlockRing->NextOrder);
     for (Index = 0; Index < (1ul << BlockRing->Order); ++Index) {
         XENBUS_DEBUG(Printf, Debug,
                      "BLOCKRING: Grants[%-2d] : 0x%p (%u)\n", 
@@ -497,24 +764,17 @@ BlockRingDebugCallback(
                      BlockRing->Grants[Index],
                      GranterReference(Granter, BlockRing->Grants[Index]));
     }
-
-    BlockRing->Submitted = BlockRing->Received = 0;
 }
 
-VOID
-BlockRingPoll(
-    IN  PXENVBD_BLOCKRING           BlockRing
+static FORCEINLINE ULONG
+__BlockRingHarvest(
+    IN  PXENVBD_BLOCKRING           BlockRing,
+    OUT PXENVBD_RESPONSE            Responses,
+    IN  ULONG                       Maximum,
+    OUT PULONG64                    Now
     )
 {
-    PXENVBD_PDO Pdo = FrontendGetPdo(BlockRing->Frontend);
-
-    ASSERT3U(KeGetCurrentIrql(), ==, DISPATCH_LEVEL);
-    KeAcquireSpinLockAtDpcLevel(&BlockRing->Lock);
-
-    // Guard against this locked region being called after the 
-    // lock on FrontendSetState
-    if (BlockRing->Enabled == FALSE)
-        goto done;
+    ULONG   Count = 0;
 
     for (;;) {
         ULONG   rsp_prod;
@@ -530,7 +790,7 @@ BlockRingPoll(
         if (rsp_cons == rsp_prod)
             break;
 
-        while (rsp_cons != rsp_prod) {
+        while (rsp_cons != rsp_prod && Count < Maximum) {
             blkif_response_t*   Response;
             ULONG               Tag;
 
@@ -539,7 +799,9 @@ BlockRingPoll(
 
             if (__BlockRingPutTag(BlockRing, Response->id, &Tag)) {
                 ++BlockRing->Received;
-                PdoCompleteResponse(Pdo, Tag, Response->status);
+                Responses[Count].Tag = Tag;
+                Responses[Count].Status = Response->status;
+                ++Count;
             }
 
             RtlZeroMemory(Response, sizeof(union blkif_sring_entry));
@@ -549,10 +811,75 @@ BlockRingPoll(
 
         BlockRing->FrontRing.rsp_cons = rsp_cons;
         BlockRing->SharedRing->rsp_event = rsp_cons + 1;
+
+        if (Count == Maximum)
+            break;
+    }
+
+    // one timestamp for the batch, PdoCompleteResponse uses it too
+    if (Count != 0) {
+        *Now = HistogramNow();
+
+        __BlockRingSample(BlockRing, *Now);
+        __BlockRingFullEnd(BlockRing, *Now);
     }
 
-done:
-    KeReleaseSpinLockFromDpcLevel(&BlockRing->Lock);
+    return Count;
+}
+
+VOID
+BlockRingPoll(
+    IN  PXENVBD_BLOCKRING           BlockRing
+    )
+{
+    PXENVBD_PDO     Pdo = FrontendGetPdo(BlockRing->Frontend);
+    XENVBD_RESPONSE Responses[BLOCKRING_POLL_BATCH];
+    ULONG           Count;
+    ULONG           Index;
+    ULONG64         Now = 0;
+
+    ASSERT3U(KeGetCurrentIrql(), ==, DISPATCH_LEVEL);
+
+    do {
+        KeAcquireSpinLockAtDpcLevel(&BlockRing->Lock);
+
+        // Guard against this locked region being called after the 
+        // lock on FrontendSetState
+        if (BlockRing->Enabled == FALSE) {
+            KeReleaseSpinLockFromDpcLevel(&BlockRing->Lock);
+            break;
+        }
+
+        PROFILE(ProfilePoll,
+                Count = __BlockRingHarvest(BlockRing, Responses, BLOCKRING_POLL_BATCH, &Now));
+        InterlockedIncrement(&BlockRing->Completing);
+
+        KeReleaseSpinLockFromDpcLevel(&BlockRing->Lock);
+
+        EtwRingPoll(PdoGetTargetId(Pdo), Count, BLOCKRING_POLL_BATCH);
+
+        // copy-out, teardown and SRB completion run without the ring lock
+        // so submitters on other CPUs are not held up
+        for (Index = 0; Index < Count; ++Index)
+            PdoCompleteResponse(Pdo, Responses[Index].Tag, Responses[Index].Status, Now);
+
+        InterlockedDecrement(&BlockRing->Completing);
+    } while (Count == BLOCKRING_POLL_BATCH);
+}
+
+BOOLEAN
+BlockRingCanSubmit(
+    IN  PXENVBD_BLOCKRING           BlockRing
+    )
+{
+    // Unlocked snapshot, only used as a hint. BlockRingSubmit rechecks
+    // for a full ring under the lock
+    if (BlockRing->Enabled == FALSE)
+        return FALSE;
+
+    KeMemoryBarrier();
+
+    return !RING_FULL(&BlockRing->FrontRing);
 }
 
 BOOLEAN
@@ -567,20 +894,26 @@ BlockRingSubmit(
 
     KeAcquireSpinLock(&BlockRing->Lock, &Irql);
     if (RING_FULL(&BlockRing->FrontRing)) {
+        __BlockRingFullBegin(BlockRing, Request->SubmitTime);
         KeReleaseSpinLock(&BlockRing->Lock, Irql);
         return FALSE;
     }
 
     req = RING_GET_REQUEST(&BlockRing->FrontRing, BlockRing->FrontRing.req_prod_pvt);
-    __BlockRingInsert(BlockRing, Request, req);
+    Request->RingIndex = BlockRing->FrontRing.req_prod_pvt;
+    PROFILE(ProfileSubmit,
+            __BlockRingInsert(BlockRing, Request, req));
+    EtwRequestSubmit(FrontendGetTargetId(BlockRing->Frontend), Request);
     KeMemoryBarrier();
     ++BlockRing->FrontRing.req_prod_pvt;
+    __BlockRingSample(BlockRing, Request->SubmitTime);
 
     RING_PUSH_REQUESTS_AND_CHECK_NOTIFY(&BlockRing->FrontRing, Notify);
     KeReleaseSpinLock(&BlockRing->Lock, Irql);
 
     if (Notify)
-        NotifierSend(FrontendGetNotifier(BlockRing->Frontend));
+        PROFILE(ProfileNotify,
+                NotifierSend(FrontendGetNotifier(BlockRing->Frontend)));
 
     return TRUE;
 }
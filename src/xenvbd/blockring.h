@@ -88,6 +88,12 @@ BlockRingPoll(
     IN  PXENVBD_BLOCKRING           BlockRing
     );
 
+extern BOOLEAN
+BlockRingCanSubmit(
+    IN  PXENVBD_BLOCKRING           BlockRing
+    );
+
+// Request->SubmitTime must be set, ring telemetry is sampled with it
 extern BOOLEAN
 BlockRingSubmit(
     IN  PXENVBD_BLOCKRING           BlockRing,
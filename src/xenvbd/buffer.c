@@ -39,6 +39,10 @@
 
 #define BUFFER_MIN_COUNT         32
 
+// Free buffers are kept per NUMA node. Higher nodes, and buffers
+// allocated from no particular node, share the last list
+#define BUFFER_MAX_NODES         16
+
 extern PHYSICAL_ADDRESS MmGetPhysicalAddress(PVOID BaseAddress);
 
 typedef struct _XENVBD_BUFFER {
@@ -47,10 +51,11 @@ typedef struct _XENVBD_BUFFER {
     PVOID               VAddr;
     PFN_NUMBER          Pfn;
     PVOID               Context;
+    ULONG               Node;
 } XENVBD_BUFFER, *PXENVBD_BUFFER;
 
 typedef struct _XENVBD_BOUNCE_BUFFER {
-    LIST_ENTRY          FreeList;
+    LIST_ENTRY          FreeList[BUFFER_MAX_NODES + 1];
     LIST_ENTRY          UsedList;
     ULONG               FreeSize;
     ULONG               UsedSize;
@@ -66,13 +71,18 @@ typedef struct _XENVBD_BOUNCE_BUFFER {
 
 static XENVBD_BOUNCE_BUFFER __Buffer;
 
-#define TIME_US(_us)        ((_us) * 10)
-#define TIME_MS(_ms)        (TIME_US((_ms) * 1000))
-#define TIME_S(_s)          (TIME_MS((_s) * 1000))
-#define TIME_RELATIVE(_t)   (-(_t))
+static FORCEINLINE ULONG
+__BufferSlot(
+    IN ULONG                    Node
+    )
+{
+    return (Node < BUFFER_MAX_NODES) ? Node : BUFFER_MAX_NODES;
+}
 
 static DECLSPEC_NOINLINE PXENVBD_BUFFER
-__BufferAlloc()
+__BufferAlloc(
+    IN ULONG                    Node
+    )
 {
     PXENVBD_BUFFER  BufferId;
 
@@ -82,10 +92,12 @@ __BufferAlloc()
 
     RtlZeroMemory(BufferId, sizeof(XENVBD_BUFFER));
     
-    BufferId->VAddr = __AllocPages(PAGE_SIZE, &BufferId->Mdl);
+    BufferId->VAddr = __AllocNodePages(PAGE_SIZE, Node, &BufferId->Mdl);
     if (BufferId->VAddr == NULL)
         goto fail2;
 
+    BufferId->Node = Node;
+
     BufferId->Pfn = (PFN_NUMBER)(MmGetPhysicalAddress(BufferId->VAddr).QuadPart >> PAGE_SHIFT);
     
     ++__Buffer.Allocated;
@@ -158,19 +170,20 @@ __BufferPushFreeList(
     ASSERT3P(BufferId->Entry.Flink, ==, NULL);
     ASSERT3P(BufferId->Entry.Blink, ==, NULL);
 
-    InsertHeadList(&__Buffer.FreeList, &BufferId->Entry);
+    InsertHeadList(&__Buffer.FreeList[__BufferSlot(BufferId->Node)], &BufferId->Entry);
     ++__Buffer.FreeSize;
     if (__Buffer.FreeSize > __Buffer.FreeMaxSize)
         __Buffer.FreeMaxSize = __Buffer.FreeSize;
 }
 static DECLSPEC_NOINLINE PXENVBD_BUFFER
 __BufferPopFreeList(
+    IN ULONG                    Slot
     )
 {
     PLIST_ENTRY     Entry;
 
-    Entry = RemoveHeadList(&__Buffer.FreeList);
-    if (Entry && Entry != &__Buffer.FreeList) {
+    Entry = RemoveHeadList(&__Buffer.FreeList[Slot]);
+    if (Entry && Entry != &__Buffer.FreeList[Slot]) {
         PXENVBD_BUFFER BufferId = CONTAINING_RECORD(Entry, XENVBD_BUFFER, Entry);
         BufferId->Entry.Flink = NULL;
         BufferId->Entry.Blink = NULL;
@@ -180,6 +193,21 @@ __BufferPopFreeList(
 
     return NULL;
 }
+static DECLSPEC_NOINLINE PXENVBD_BUFFER
+__BufferPopAnyFreeList(
+    )
+{
+    PXENVBD_BUFFER  BufferId;
+    ULONG           Slot;
+
+    for (Slot = 0; Slot <= BUFFER_MAX_NODES; ++Slot) {
+        BufferId = __BufferPopFreeList(Slot);
+        if (BufferId)
+            return BufferId;
+    }
+
+    return NULL;
+}
 static DECLSPEC_NOINLINE VOID
 __BufferPushUsedList(
     IN PXENVBD_BUFFER           BufferId
@@ -251,7 +279,7 @@ __BufferReaperThread(
             ++__Buffer.ReapThreadCount;
         }
         while (__Buffer.FreeSize > BUFFER_MIN_COUNT) {
-            BufferId = __BufferPopFreeList();
+            BufferId = __BufferPopAnyFreeList();
             if (BufferId) {
                 ++__Buffer.Reaped;
                 __BufferFree(BufferId);
@@ -272,11 +300,12 @@ BufferInitialize(
 
     RtlZeroMemory(&__Buffer, sizeof(XENVBD_BOUNCE_BUFFER));
     KeInitializeSpinLock(&__Buffer.Lock);
-    InitializeListHead(&__Buffer.FreeList);
+    for (i = 0; i <= BUFFER_MAX_NODES; ++i)
+        InitializeListHead(&__Buffer.FreeList[i]);
     InitializeListHead(&__Buffer.UsedList);
 
     for (i = 0; i < BUFFER_MIN_COUNT; ++i) {
-        BufferId = __BufferAlloc();
+        BufferId = __BufferAlloc(XENVBD_NUMA_ANY_NODE);
         if (BufferId) {
             __BufferPushFreeList(BufferId);
         }
@@ -303,7 +332,7 @@ BufferTerminate(
         Warning("Potentially leaking buffer @ 0x%p\n", BufferId->VAddr);
         __BufferPushFreeList(BufferId);
     }
-    while ((BufferId = __BufferPopFreeList()) != NULL) {
+    while ((BufferId = __BufferPopAnyFreeList()) != NULL) {
         __BufferFree(BufferId);
     }
 }
@@ -312,6 +341,7 @@ __checkReturn
 BOOLEAN
 BufferGet(
     __in  PVOID             _Context,
+    __in  ULONG             Node,
     __out PVOID*            _BufferId,
     __out PFN_NUMBER*       Pfn
     )
@@ -323,10 +353,14 @@ BufferGet(
 	*_BufferId = NULL;
 	*Pfn = 0;
 
+    // prefer a page on the caller's node, then any free page
     KeAcquireSpinLock(&__Buffer.Lock, &Irql);
-    BufferId = __BufferPopFreeList();
+    BufferId = __BufferPopFreeList(__BufferSlot(Node));
+    if (BufferId == NULL) {
+        BufferId = __BufferAlloc(Node);
+    }
     if (BufferId == NULL) {
-        BufferId = __BufferAlloc();
+        BufferId = __BufferPopAnyFreeList();
     }
     if (BufferId) {
         __BufferPushUsedList(BufferId);
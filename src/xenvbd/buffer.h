@@ -48,6 +48,7 @@ __checkReturn
 extern BOOLEAN
 BufferGet(
     __in  PVOID             Context,
+    __in  ULONG             Node,
     __out PVOID*            BufferId,
     __out PFN_NUMBER*       Pfn
     );
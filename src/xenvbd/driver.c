@@ -34,6 +34,8 @@
 #include "pdo.h"
 #include "srbext.h"
 #include "buffer.h"
+#include "numa.h"
+#include "etw.h"
 #include "debug.h"
 #include "assert.h"
 #include "util.h"
@@ -42,6 +44,8 @@
 #include <xencrsh_interface.h>
 #include <xenvbd-ntstrsafe.h>
 
+#include <stdlib.h>
+
 #define IS_NULL         ((ULONG)'llun')
 #define IS_FDO          ((ULONG)'odf')
 #define IS_PDO          ((ULONG)'odp')
@@ -172,6 +176,13 @@ __DriverParseParameterKey(
     // Set default parameters
     DriverParameters.SynthesizeInquiry = FALSE;
     DriverParameters.PVCDRom           = FALSE;
+    DriverParameters.StatsInterval     = 0;
+    DriverParameters.SlowThreshold     = 1000;
+    DriverParameters.RingPolicy        = XENVBD_RING_POLICY_ADAPTIVE;
+    DriverParameters.RingPageOrder     = XENVBD_DEFAULT_RING_PAGE_ORDER;
+    DriverParameters.RingPageBudget    = 0;
+    DriverParameters.NumaPolicy        = XENVBD_NUMA_POLICY_SPREAD;
+    DriverParameters.MemoryBudget      = 0;
 
     // attempt to read registry for system start parameters
     Status = __DriverGetSystemStartParams(&Options);
@@ -199,12 +210,87 @@ __DriverParseParameterKey(
             }
         }
 
+        if (__DriverGetOption(Options, L"XENVBD:STATS_INTERVAL=", &Value)) {
+            // Value may be NULL (it shouldnt be though!)
+            if (Value) {
+                DriverParameters.StatsInterval = wcstoul(Value, NULL, 10);
+                __FreePoolWithTag(Value, XENVBD_POOL_TAG);
+            }
+        }
+
+        if (__DriverGetOption(Options, L"XENVBD:SLOW_THRESHOLD=", &Value)) {
+            // Value may be NULL (it shouldnt be though!)
+            if (Value) {
+                DriverParameters.SlowThreshold = wcstoul(Value, NULL, 10);
+                __FreePoolWithTag(Value, XENVBD_POOL_TAG);
+            }
+        }
+
+        if (__DriverGetOption(Options, L"XENVBD:RING_POLICY=", &Value)) {
+            // Value may be NULL (it shouldnt be though!)
+            if (Value) {
+                if (wcscmp(Value, L"MAX") == 0) {
+                    DriverParameters.RingPolicy = XENVBD_RING_POLICY_MAX;
+                } else if (wcscmp(Value, L"FIXED") == 0) {
+                    DriverParameters.RingPolicy = XENVBD_RING_POLICY_FIXED;
+                } else if (wcscmp(Value, L"ADAPTIVE") == 0) {
+                    DriverParameters.RingPolicy = XENVBD_RING_POLICY_ADAPTIVE;
+                }
+                __FreePoolWithTag(Value, XENVBD_POOL_TAG);
+            }
+        }
+
+        if (__DriverGetOption(Options, L"XENVBD:RING_PAGE_ORDER=", &Value)) {
+            // Value may be NULL (it shouldnt be though!)
+            if (Value) {
+                DriverParameters.RingPageOrder = wcstoul(Value, NULL, 10);
+                if (DriverParameters.RingPageOrder > XENVBD_MAX_RING_PAGE_ORDER)
+                    DriverParameters.RingPageOrder = XENVBD_MAX_RING_PAGE_ORDER;
+                __FreePoolWithTag(Value, XENVBD_POOL_TAG);
+            }
+        }
+
+        if (__DriverGetOption(Options, L"XENVBD:RING_PAGE_BUDGET=", &Value)) {
+            // Value may be NULL (it shouldnt be though!)
+            if (Value) {
+                DriverParameters.RingPageBudget = wcstoul(Value, NULL, 10);
+                __FreePoolWithTag(Value, XENVBD_POOL_TAG);
+            }
+        }
+
+        if (__DriverGetOption(Options, L"XENVBD:NUMA=", &Value)) {
+            // Value may be NULL (it shouldnt be though!)
+            if (Value) {
+                if (wcscmp(Value, L"OFF") == 0) {
+                    DriverParameters.NumaPolicy = XENVBD_NUMA_POLICY_OFF;
+                } else if (wcscmp(Value, L"SPREAD") == 0) {
+                    DriverParameters.NumaPolicy = XENVBD_NUMA_POLICY_SPREAD;
+                }
+                __FreePoolWithTag(Value, XENVBD_POOL_TAG);
+            }
+        }
+
+        if (__DriverGetOption(Options, L"XENVBD:MEMORY_BUDGET=", &Value)) {
+            // Value may be NULL (it shouldnt be though!)
+            if (Value) {
+                DriverParameters.MemoryBudget = wcstoul(Value, NULL, 10);
+                __FreePoolWithTag(Value, XENVBD_POOL_TAG);
+            }
+        }
+
         __FreePoolWithTag(Options, XENVBD_POOL_TAG);
     }
 
-    Verbose("DriverParameters: %s%s\n", 
+    Verbose("DriverParameters: %s%sSTATS_INTERVAL=%u SLOW_THRESHOLD=%u RING_POLICY=%u RING_PAGE_ORDER=%u RING_PAGE_BUDGET=%u NUMA=%u MEMORY_BUDGET=%u\n", 
             DriverParameters.SynthesizeInquiry ? "SYNTH_INQ " : "",
-            DriverParameters.PVCDRom ? "PV_CDROM " : "");
+            DriverParameters.PVCDRom ? "PV_CDROM " : "",
+            DriverParameters.StatsInterval,
+            DriverParameters.SlowThreshold,
+            DriverParameters.RingPolicy,
+            DriverParameters.RingPageOrder,
+            DriverParameters.RingPageBudget,
+            DriverParameters.NumaPolicy,
+            DriverParameters.MemoryBudget);
 }
 
 //=============================================================================
@@ -631,6 +717,7 @@ DriverUnload(
          MAJOR_VERSION_STR "." MINOR_VERSION_STR "." MICRO_VERSION_STR "." BUILD_NUMBER_STR,
          DAY_STR "/" MONTH_STR "/" YEAR_STR);
     StorPortDriverUnload(_DriverObject);
+    EtwTerminate();
     BufferTerminate();
     ZwClose(DriverStatusKey);
     Trace("<=== (Irql=%d)\n", KeGetCurrentIrql());
@@ -699,7 +786,9 @@ DriverEntry(
     KeInitializeSpinLock(&__XenvbdLock);
     __XenvbdFdo = NULL;
     BufferInitialize();
+    (VOID) EtwInitialize();
     __DriverParseParameterKey();
+    NumaInitialize();
 
     RtlZeroMemory(&InitData, sizeof(InitData));
 
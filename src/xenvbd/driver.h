@@ -38,8 +38,9 @@
 // Global Constants
 #define XENVBD_MAX_TARGETS              (255)
 
-#define XENVBD_MAX_RING_PAGE_ORDER      (4)
+#define XENVBD_MAX_RING_PAGE_ORDER      (6)
 #define XENVBD_MAX_RING_PAGES           (1 << XENVBD_MAX_RING_PAGE_ORDER)
+#define XENVBD_DEFAULT_RING_PAGE_ORDER  (4)
 
 #define XENVBD_MAX_SEGMENTS_PER_REQUEST (BLKIF_MAX_SEGMENTS_PER_REQUEST)
 #define XENVBD_MAX_REQUESTS_PER_SRB     (16)
@@ -50,9 +51,30 @@
 
 #define XENVBD_MIN_GRANT_REFS           (XENVBD_MAX_SEGMENTS_PER_SRB)
 
+// How each target picks its ring size, within the backend's
+// max-ring-page-order. A "ring-page-order-hint" in the frontend area
+// overrides the policy for that target
+typedef enum _XENVBD_RING_POLICY {
+    XENVBD_RING_POLICY_MAX = 0,     // largest the backend allows
+    XENVBD_RING_POLICY_FIXED,       // RingPageOrder
+    XENVBD_RING_POLICY_ADAPTIVE     // RingPageOrder, then by load at the last connect
+} XENVBD_RING_POLICY;
+
+typedef enum _XENVBD_NUMA_POLICY {
+    XENVBD_NUMA_POLICY_OFF = 0,     // allocate anywhere, channels left where XenBus puts them
+    XENVBD_NUMA_POLICY_SPREAD       // each target on one node, targets spread over nodes
+} XENVBD_NUMA_POLICY;
+
 typedef struct _XENVBD_PARAMETERS {
     BOOLEAN     SynthesizeInquiry;
     BOOLEAN     PVCDRom;
+    ULONG       StatsInterval;      // seconds, 0 = do not publish stats
+    ULONG       SlowThreshold;      // ms, 0 = do not capture outliers
+    XENVBD_RING_POLICY  RingPolicy;
+    ULONG       RingPageOrder;
+    ULONG       RingPageBudget;     // pages over all targets, 0 = no limit
+    XENVBD_NUMA_POLICY  NumaPolicy;
+    ULONG       MemoryBudget;       // data path pages over all targets, 0 = no limit
 } XENVBD_PARAMETERS;
 
 extern XENVBD_PARAMETERS    DriverParameters;
@@ -0,0 +1,308 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, 
+ * with or without modification, are permitted provided 
+ * that the following conditions are met:
+ * 
+ * *   Redistributions of source code must retain the above 
+ *     copyright notice, this list of conditions and the 
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above 
+ *     copyright notice, this list of conditions and the 
+ *     following disclaimer in the documentation and/or other 
+ *     materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND 
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF 
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR 
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF 
+ * SUCH DAMAGE.
+ */ 
+
+#include "etw.h"
+#include "debug.h"
+#include "assert.h"
+#include <xencdb.h>
+#include <evntrace.h>
+
+static const GUID   EtwProviderGuid = {
+    0x5b0fea3c, 0x4a5d, 0x4e0c, { 0x9c, 0x3a, 0x2f, 0x1e, 0x8d, 0x7c, 0x0b, 0x11 }
+};
+
+static REGHANDLE    EtwRegHandle;
+
+volatile ULONG64    EtwKeywords;
+
+static VOID
+EtwEnableCallback(
+    __in LPCGUID                    SourceId,
+    __in ULONG                      ControlCode,
+    __in UCHAR                      Level,
+    __in ULONGLONG                  MatchAnyKeyword,
+    __in ULONGLONG                  MatchAllKeyword,
+    __in_opt PEVENT_FILTER_DESCRIPTOR FilterData,
+    __in_opt PVOID                  CallbackContext
+    )
+{
+    UNREFERENCED_PARAMETER(SourceId);
+    UNREFERENCED_PARAMETER(MatchAllKeyword);
+    UNREFERENCED_PARAMETER(FilterData);
+    UNREFERENCED_PARAMETER(CallbackContext);
+
+    switch (ControlCode) {
+    case EVENT_CONTROL_CODE_ENABLE_PROVIDER:
+        if (Level != 0 && Level < TRACE_LEVEL_INFORMATION) {
+            EtwKeywords = 0;
+            break;
+        }
+        // no keywords selected means all keywords
+        EtwKeywords = (MatchAnyKeyword == 0) ? ~0ull : MatchAnyKeyword;
+        break;
+
+    case EVENT_CONTROL_CODE_DISABLE_PROVIDER:
+        EtwKeywords = 0;
+        break;
+
+    default:
+        break;
+    }
+
+    Verbose("ControlCode %u Level %u Keywords %llx\n",
+            ControlCode, Level, EtwKeywords);
+}
+
+NTSTATUS
+EtwInitialize(
+    VOID
+    )
+{
+    NTSTATUS    Status;
+
+    EtwKeywords = 0;
+
+    Status = EtwRegister(&EtwProviderGuid,
+                         EtwEnableCallback,
+                         NULL,
+                         &EtwRegHandle);
+    if (!NT_SUCCESS(Status))
+        goto fail1;
+
+    return STATUS_SUCCESS;
+
+fail1:
+    Error("fail1 (%08x)\n", Status);
+    EtwRegHandle = 0;
+    return Status;
+}
+
+VOID
+EtwTerminate(
+    VOID
+    )
+{
+    EtwKeywords = 0;
+
+    if (EtwRegHandle == 0)
+        return;
+
+    (VOID) EtwUnregister(EtwRegHandle);
+    EtwRegHandle = 0;
+}
+
+VOID
+EtwWriteEvent(
+    __in XENVBD_ETW_EVENT       Event,
+    __in ULONG64                Keyword,
+    __in_bcount(Length) PVOID   Payload,
+    __in ULONG                  Length
+    )
+{
+    EVENT_DESCRIPTOR        Descriptor;
+    EVENT_DATA_DESCRIPTOR   Data;
+
+    if (EtwRegHandle == 0)
+        return;
+
+    EventDescCreate(&Descriptor,
+                    (USHORT)Event,
+                    0,                          // Version
+                    0,                          // Channel
+                    TRACE_LEVEL_INFORMATION,
+                    0,                          // Task
+                    0,                          // Opcode
+                    Keyword);
+    EventDataDescCreate(&Data, Payload, Length);
+
+    (VOID) EtwWrite(EtwRegHandle, &Descriptor, NULL, 1, &Data);
+}
+
+VOID
+__EtwSrbStart(
+    __in PSCSI_REQUEST_BLOCK    Srb
+    )
+{
+    XENVBD_ETW_SRB_START    Payload;
+
+    RtlZeroMemory(&Payload, sizeof(Payload));
+    Payload.Srb         = (ULONG64)(ULONG_PTR)Srb;
+    Payload.Length      = Srb->DataTransferLength;
+    Payload.TargetId    = Srb->TargetId;
+    Payload.Function    = Srb->Function;
+
+    if (Srb->Function == SRB_FUNCTION_EXECUTE_SCSI) {
+        Payload.Operation = Cdb_OperationEx(Srb);
+
+        switch (Payload.Operation) {
+        case SCSIOP_READ:
+        case SCSIOP_WRITE:
+            Payload.Lba = Cdb_LogicalBlock(Srb);
+            break;
+        default:
+            break;
+        }
+    }
+
+    EtwWriteEvent(EtwEventSrbStart,
+                  XENVBD_ETW_KEYWORD_SRB,
+                  &Payload,
+                  sizeof(Payload));
+}
+
+VOID
+__EtwSrbPrepared(
+    __in ULONG                  TargetId,
+    __in PXENVBD_SRBEXT         SrbExt,
+    __in PLIST_ENTRY            List
+    )
+{
+    XENVBD_ETW_SRB_PREPARED Payload;
+    PLIST_ENTRY             Entry;
+
+    RtlZeroMemory(&Payload, sizeof(Payload));
+    Payload.Srb         = (ULONG64)(ULONG_PTR)SrbExt->Srb;
+    Payload.TargetId    = (UCHAR)TargetId;
+
+    for (Entry = List->Flink; Entry != List; Entry = Entry->Flink) {
+        PXENVBD_REQUEST Request = CONTAINING_RECORD(Entry, XENVBD_REQUEST, Entry);
+        PLIST_ENTRY     SegEntry;
+
+        ++Payload.Requests;
+        if (Request->NrSegments > BLKIF_MAX_SEGMENTS_PER_REQUEST)
+            Payload.Flags |= XENVBD_ETW_FLAG_INDIRECT;
+
+        if (Request->Operation != BLKIF_OP_READ &&
+            Request->Operation != BLKIF_OP_WRITE)
+            continue;
+
+        for (SegEntry = Request->Segments.Flink;
+             SegEntry != &Request->Segments;
+             SegEntry = SegEntry->Flink) {
+            PXENVBD_SEGMENT Segment = CONTAINING_RECORD(SegEntry, XENVBD_SEGMENT, Entry);
+
+            ++Payload.Segments;
+            if (Segment->BufferId != NULL)
+                ++Payload.Bounced;
+        }
+    }
+    if (Payload.Bounced)
+        Payload.Flags |= XENVBD_ETW_FLAG_BOUNCED;
+
+    EtwWriteEvent(EtwEventSrbPrepared,
+                  XENVBD_ETW_KEYWORD_SRB,
+                  &Payload,
+                  sizeof(Payload));
+}
+
+VOID
+__EtwRequestSubmit(
+    __in ULONG                  TargetId,
+    __in PXENVBD_REQUEST        Request
+    )
+{
+    XENVBD_ETW_REQUEST_SUBMIT   Payload;
+
+    RtlZeroMemory(&Payload, sizeof(Payload));
+    Payload.Srb         = (ULONG64)(ULONG_PTR)Request->Srb;
+    Payload.Sector      = Request->FirstSector;
+    Payload.Tag         = Request->Id;
+    Payload.Segments    = Request->NrSegments;
+    Payload.TargetId    = (UCHAR)TargetId;
+    Payload.Operation   = Request->Operation;
+
+    EtwWriteEvent(EtwEventRequestSubmit,
+                  XENVBD_ETW_KEYWORD_REQUEST,
+                  &Payload,
+                  sizeof(Payload));
+}
+
+VOID
+__EtwRingPoll(
+    __in ULONG                  TargetId,
+    __in ULONG                  Responses,
+    __in ULONG                  Budget
+    )
+{
+    XENVBD_ETW_RING_POLL    Payload;
+
+    RtlZeroMemory(&Payload, sizeof(Payload));
+    Payload.Responses   = Responses;
+    Payload.Budget      = Budget;
+    Payload.TargetId    = (UCHAR)TargetId;
+
+    EtwWriteEvent(EtwEventRingPoll,
+                  XENVBD_ETW_KEYWORD_RING,
+                  &Payload,
+                  sizeof(Payload));
+}
+
+VOID
+__EtwRequestComplete(
+    __in ULONG                  TargetId,
+    __in PXENVBD_REQUEST        Request,
+    __in SHORT                  Status
+    )
+{
+    XENVBD_ETW_REQUEST_COMPLETE Payload;
+
+    RtlZeroMemory(&Payload, sizeof(Payload));
+    Payload.Srb         = (ULONG64)(ULONG_PTR)Request->Srb;
+    Payload.Tag         = Request->Id;
+    Payload.Status      = Status;
+    Payload.TargetId    = (UCHAR)TargetId;
+    Payload.Operation   = Request->Operation;
+
+    EtwWriteEvent(EtwEventRequestComplete,
+                  XENVBD_ETW_KEYWORD_REQUEST,
+                  &Payload,
+                  sizeof(Payload));
+}
+
+VOID
+__EtwSrbComplete(
+    __in PSCSI_REQUEST_BLOCK    Srb
+    )
+{
+    XENVBD_ETW_SRB_COMPLETE Payload;
+
+    RtlZeroMemory(&Payload, sizeof(Payload));
+    Payload.Srb         = (ULONG64)(ULONG_PTR)Srb;
+    Payload.Length      = Srb->DataTransferLength;
+    Payload.TargetId    = Srb->TargetId;
+    Payload.SrbStatus   = Srb->SrbStatus;
+    Payload.ScsiStatus  = Srb->ScsiStatus;
+
+    EtwWriteEvent(EtwEventSrbComplete,
+                  XENVBD_ETW_KEYWORD_SRB,
+                  &Payload,
+                  sizeof(Payload));
+}
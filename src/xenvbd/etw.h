@@ -0,0 +1,234 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, 
+ * with or without modification, are permitted provided 
+ * that the following conditions are met:
+ * 
+ * *   Redistributions of source code must retain the above 
+ *     copyright notice, this list of conditions and the 
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above 
+ *     copyright notice, this list of conditions and the 
+ *     following disclaimer in the documentation and/or other 
+ *     materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND 
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF 
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR 
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF 
+ * SUCH DAMAGE.
+ */ 
+
+#ifndef _XENVBD_ETW_H
+#define _XENVBD_ETW_H
+
+#include <ntddk.h>
+#include <xenvbd-storport.h>
+#include "srbext.h"
+
+// Provider "XENVBD" {5B0FEA3C-4A5D-4E0C-9C3A-2F1E8D7C0B11}
+
+// Keywords
+#define XENVBD_ETW_KEYWORD_SRB          0x0000000000000001ull
+#define XENVBD_ETW_KEYWORD_REQUEST      0x0000000000000002ull
+#define XENVBD_ETW_KEYWORD_RING         0x0000000000000004ull
+
+// Event Ids. All events are written at TRACE_LEVEL_INFORMATION with a
+// single packed payload, laid out as below
+typedef enum _XENVBD_ETW_EVENT {
+    EtwEventSrbStart = 1,       // XENVBD_ETW_SRB_START
+    EtwEventSrbPrepared,        // XENVBD_ETW_SRB_PREPARED
+    EtwEventRequestSubmit,      // XENVBD_ETW_REQUEST_SUBMIT
+    EtwEventRingPoll,           // XENVBD_ETW_RING_POLL
+    EtwEventRequestComplete,    // XENVBD_ETW_REQUEST_COMPLETE
+    EtwEventSrbComplete         // XENVBD_ETW_SRB_COMPLETE
+} XENVBD_ETW_EVENT;
+
+#define XENVBD_ETW_FLAG_BOUNCED     0x01    // one or more segments bounced
+#define XENVBD_ETW_FLAG_INDIRECT    0x02    // one or more BLKIF_OP_INDIRECTs
+
+#pragma pack(push, 1)
+typedef struct _XENVBD_ETW_SRB_START {
+    ULONG64     Srb;
+    ULONG64     Lba;
+    ULONG       Length;
+    UCHAR       TargetId;
+    UCHAR       Function;
+    UCHAR       Operation;
+} XENVBD_ETW_SRB_START, *PXENVBD_ETW_SRB_START;
+
+typedef struct _XENVBD_ETW_SRB_PREPARED {
+    ULONG64     Srb;
+    ULONG       Requests;
+    ULONG       Segments;
+    ULONG       Bounced;
+    UCHAR       TargetId;
+    UCHAR       Flags;
+} XENVBD_ETW_SRB_PREPARED, *PXENVBD_ETW_SRB_PREPARED;
+
+typedef struct _XENVBD_ETW_REQUEST_SUBMIT {
+    ULONG64     Srb;
+    ULONG64     Sector;
+    ULONG       Tag;
+    USHORT      Segments;
+    UCHAR       TargetId;
+    UCHAR       Operation;
+} XENVBD_ETW_REQUEST_SUBMIT, *PXENVBD_ETW_REQUEST_SUBMIT;
+
+typedef struct _XENVBD_ETW_RING_POLL {
+    ULONG       Responses;
+    ULONG       Budget;
+    UCHAR       TargetId;
+} XENVBD_ETW_RING_POLL, *PXENVBD_ETW_RING_POLL;
+
+typedef struct _XENVBD_ETW_REQUEST_COMPLETE {
+    ULONG64     Srb;
+    ULONG       Tag;
+    SHORT       Status;
+    UCHAR       TargetId;
+    UCHAR       Operation;
+} XENVBD_ETW_REQUEST_COMPLETE, *PXENVBD_ETW_REQUEST_COMPLETE;
+
+typedef struct _XENVBD_ETW_SRB_COMPLETE {
+    ULONG64     Srb;
+    ULONG       Length;
+    UCHAR       TargetId;
+    UCHAR       SrbStatus;
+    UCHAR       ScsiStatus;
+} XENVBD_ETW_SRB_COMPLETE, *PXENVBD_ETW_SRB_COMPLETE;
+#pragma pack(pop)
+
+// Keywords enabled by the current sessions, 0 if nobody is listening
+extern volatile ULONG64     EtwKeywords;
+
+#define EtwIsEnabled(_Keyword)  ((EtwKeywords & (_Keyword)) != 0)
+
+extern NTSTATUS
+EtwInitialize(
+    VOID
+    );
+
+extern VOID
+EtwTerminate(
+    VOID
+    );
+
+extern VOID
+EtwWriteEvent(
+    __in XENVBD_ETW_EVENT       Event,
+    __in ULONG64                Keyword,
+    __in_bcount(Length) PVOID   Payload,
+    __in ULONG                  Length
+    );
+
+// Call sites are wrapped so that a disabled provider costs a single load
+// and branch
+extern VOID
+__EtwSrbStart(
+    __in PSCSI_REQUEST_BLOCK    Srb
+    );
+
+static FORCEINLINE VOID
+EtwSrbStart(
+    __in PSCSI_REQUEST_BLOCK    Srb
+    )
+{
+    if (EtwIsEnabled(XENVBD_ETW_KEYWORD_SRB))
+        __EtwSrbStart(Srb);
+}
+
+extern VOID
+__EtwSrbPrepared(
+    __in ULONG                  TargetId,
+    __in PXENVBD_SRBEXT         SrbExt,
+    __in PLIST_ENTRY            List
+    );
+
+static FORCEINLINE VOID
+EtwSrbPrepared(
+    __in ULONG                  TargetId,
+    __in PXENVBD_SRBEXT         SrbExt,
+    __in PLIST_ENTRY            List
+    )
+{
+    if (EtwIsEnabled(XENVBD_ETW_KEYWORD_SRB))
+        __EtwSrbPrepared(TargetId, SrbExt, List);
+}
+
+extern VOID
+__EtwRequestSubmit(
+    __in ULONG                  TargetId,
+    __in PXENVBD_REQUEST        Request
+    );
+
+static FORCEINLINE VOID
+EtwRequestSubmit(
+    __in ULONG                  TargetId,
+    __in PXENVBD_REQUEST        Request
+    )
+{
+    if (EtwIsEnabled(XENVBD_ETW_KEYWORD_REQUEST))
+        __EtwRequestSubmit(TargetId, Request);
+}
+
+extern VOID
+__EtwRingPoll(
+    __in ULONG                  TargetId,
+    __in ULONG                  Responses,
+    __in ULONG                  Budget
+    );
+
+static FORCEINLINE VOID
+EtwRingPoll(
+    __in ULONG                  TargetId,
+    __in ULONG                  Responses,
+    __in ULONG                  Budget
+    )
+{
+    if (EtwIsEnabled(XENVBD_ETW_KEYWORD_RING))
+        __EtwRingPoll(TargetId, Responses, Budget);
+}
+
+extern VOID
+__EtwRequestComplete(
+    __in ULONG                  TargetId,
+    __in PXENVBD_REQUEST        Request,
+    __in SHORT                  Status
+    );
+
+static FORCEINLINE VOID
+EtwRequestComplete(
+    __in ULONG                  TargetId,
+    __in PXENVBD_REQUEST        Request,
+    __in SHORT                  Status
+    )
+{
+    if (EtwIsEnabled(XENVBD_ETW_KEYWORD_REQUEST))
+        __EtwRequestComplete(TargetId, Request, Status);
+}
+
+extern VOID
+__EtwSrbComplete(
+    __in PSCSI_REQUEST_BLOCK    Srb
+    );
+
+static FORCEINLINE VOID
+EtwSrbComplete(
+    __in PSCSI_REQUEST_BLOCK    Srb
+    )
+{
+    if (EtwIsEnabled(XENVBD_ETW_KEYWORD_SRB))
+        __EtwSrbComplete(Srb);
+}
+
+#endif // _XENVBD_ETW_H
@@ -41,6 +41,10 @@
 #include "debug.h"
 #include "assert.h"
 #include "util.h"
+#include "wmi.h"
+#include "etw.h"
+#include "profile.h"
+#include "numa.h"
 #include <version.h>
 #include <xencdb.h>
 #include <names.h>
@@ -52,11 +56,37 @@
 #include <emulated_interface.h>
 
 #include <stdlib.h>
+#include <scsiwmi.h>
 
 #define MAXNAMELEN  128
 
 #define FDO_SIGNATURE   'odfX'
 
+typedef NTSTATUS (*XENVBD_TARGET_FUNCTION)(PXENVBD_PDO);
+
+typedef struct _XENVBD_TARGET_WORK {
+    XENVBD_TARGET_FUNCTION      Function;
+    PXENVBD_PDO                 Pdo;
+    PXENVBD_THREAD              Thread;
+    NTSTATUS                    Status;
+} XENVBD_TARGET_WORK, *PXENVBD_TARGET_WORK;
+
+// CPUs beyond this share a slot
+#define FDO_MAX_CPUS    64
+
+// Padding the slots out to a cache line is the point of DECLSPEC_CACHEALIGN,
+// so C4324 (structure was padded due to alignment specifier) is expected here
+#pragma warning(push)
+#pragma warning(disable:4324)
+
+// Interlocked, as a shared slot may be written from two CPUs. Each slot
+// fills a cache line and only the first 16 bytes are used, so slots stay on
+// separate lines however the device extension itself is aligned
+typedef struct _XENVBD_FDO_CPU {
+    LONG64                      StartedSrbs;
+    LONG64                      CompletedSrbs;
+} DECLSPEC_CACHEALIGN XENVBD_FDO_CPU, *PXENVBD_FDO_CPU;
+
 struct _XENVBD_FDO {
     ULONG                       Signature;
     KEVENT                      RemoveEvent;
@@ -71,6 +101,13 @@ struct _XENVBD_FDO {
     // Power
     PXENVBD_THREAD              DevicePowerThread;
     PIRP                        DevicePowerIrp;
+    PXENVBD_THREAD              ResumeThread;
+
+    // Resets - targets are drained at PASSIVE_LEVEL by ResetThread. ResetBus
+    // is set by HwResetBus, ResetSrbs are completed once their reset is done
+    PXENVBD_THREAD              ResetThread;
+    LONG                        ResetBus;
+    XENVBD_QUEUE                ResetSrbs;
 
     // Interfaces to XenBus
     XENBUS_EVTCHN_INTERFACE     Evtchn;
@@ -89,18 +126,80 @@ struct _XENVBD_FDO {
     KSPIN_LOCK                  TargetLock;
     PXENVBD_PDO                 Targets[XENVBD_MAX_TARGETS];
 
+    // Ring pages (and their grants) held by all targets' rings
+    LONG                        RingPages;
+
+    // Data path memory (requests, segments, indirect and bounce pages)
+    // credited to targets, and the number of targets holding credit
+    LONG64                      MemoryUsed;
+    LONG64                      MemoryMaximum;
+    LONG                        MemoryTargets;
+    ULONG64                     MemoryRefused;
+    ULONG64                     MemoryReclaims;
+    LONG64                      MemoryReclaimTime;
+    // Targets waiting for credit to be returned, one bit per target id
+    LONG                        MemoryWaiting[(XENVBD_MAX_TARGETS + 31) / 32];
+    LONG                        MemoryWaiters;
+    ULONG64                     MemoryWakes;
+
     // Target Enumeration
     PXENVBD_THREAD              RescanThread;
     PXENBUS_STORE_WATCH         RescanWatch;
     PXENVBD_THREAD              FrontendThread;
 
-    // Statistics
-    LONG                        CurrentSrbs;
+    // Stats published to xenstore, if DriverParameters.StatsInterval != 0
+    PXENVBD_THREAD              StatsThread;
+
+    // Statistics - monotonic, never reset
+    // MaximumSrbs is the largest CurrentSrbs seen when the counts are read
+    // (debug callback, WMI query), not a true high-water mark
     LONG                        MaximumSrbs;
-    LONG                        TotalSrbs;
+    XENVBD_FDO_CPU              Cpu[FDO_MAX_CPUS];
+
+    // WMI
+    SCSI_WMILIB_CONTEXT         WmiLibContext;
 };
 
+#pragma warning(pop)
+
 //=============================================================================
+static FORCEINLINE PXENVBD_FDO_CPU
+__FdoCpu(
+    __in PXENVBD_FDO                 Fdo
+    )
+{
+    return &Fdo->Cpu[KeGetCurrentProcessorNumberEx(NULL) % FDO_MAX_CPUS];
+}
+
+static VOID
+__FdoSrbCounts(
+    __in PXENVBD_FDO                 Fdo,
+    __out PLONG                      Current,
+    __out PLONG64                    Total
+    )
+{
+    LONG64  Started = 0;
+    LONG64  Completed = 0;
+    LONG    Maximum;
+    ULONG   Cpu;
+
+    for (Cpu = 0; Cpu < FDO_MAX_CPUS; ++Cpu) {
+        Started += Fdo->Cpu[Cpu].StartedSrbs;
+        Completed += Fdo->Cpu[Cpu].CompletedSrbs;
+    }
+
+    // slots are read one at a time, so a completion can be counted
+    // before its start
+    *Current = (Started > Completed) ? (LONG)(Started - Completed) : 0;
+    *Total = Started;
+
+    do {
+        Maximum = Fdo->MaximumSrbs;
+        if (*Current <= Maximum)
+            break;
+    } while (InterlockedCompareExchange(&Fdo->MaximumSrbs, *Current, Maximum) != Maximum);
+}
+
 static FORCEINLINE BOOLEAN
 __FdoSetDevicePowerState(
     __in PXENVBD_FDO                 Fdo,
@@ -231,6 +330,9 @@ FdoLinkPdo(
 
     if (!Result) {
         Warning("Target[%d] : Current 0x%p, New 0x%p\n", TargetId, Current, Pdo);
+    } else {
+        // the frontend thread sleeps while there are no targets to poll
+        ThreadWake(Fdo->FrontendThread);
     }
     return Result;
 }
@@ -359,6 +461,8 @@ FdoDebugCallback(
 {
     PXENVBD_FDO     Fdo = Context;
     ULONG           TargetId;
+    LONG            CurrentSrbs;
+    LONG64          TotalSrbs;
 
     if (Fdo == NULL || Fdo->DebugCallback == NULL)
         return;
@@ -383,11 +487,27 @@ FdoDebugCallback(
     XENBUS_DEBUG(Printf, &Fdo->Debug,
                  "FDO: Enumerator      : %s (0x%p)\n",
                  FdoEnum(Fdo), Fdo->Enumerator.Buffer);
+    __FdoSrbCounts(Fdo, &CurrentSrbs, &TotalSrbs);
+    XENBUS_DEBUG(Printf, &Fdo->Debug,
+                 "FDO: Srbs            : %d / %d sampled (%lld Total)\n",
+                 CurrentSrbs, Fdo->MaximumSrbs, TotalSrbs);
+    XENBUS_DEBUG(Printf, &Fdo->Debug,
+                 "FDO: RingPages       : %d / %u\n",
+                 Fdo->RingPages, DriverParameters.RingPageBudget);
     XENBUS_DEBUG(Printf, &Fdo->Debug,
-                 "FDO: Srbs            : %d / %d (%d Total)\n",
-                 Fdo->CurrentSrbs, Fdo->MaximumSrbs, Fdo->TotalSrbs);
+                 "FDO: Memory          : %lld / %lld (%u pages budget) %d targets\n",
+                 Fdo->MemoryUsed, Fdo->MemoryMaximum,
+                 DriverParameters.MemoryBudget, Fdo->MemoryTargets);
+    XENBUS_DEBUG(Printf, &Fdo->Debug,
+                 "FDO: Memory          : %llu refused %llu reclaims\n",
+                 Fdo->MemoryRefused, Fdo->MemoryReclaims);
+    XENBUS_DEBUG(Printf, &Fdo->Debug,
+                 "FDO: Memory          : %d waiting %llu wakes\n",
+                 Fdo->MemoryWaiters, Fdo->MemoryWakes);
 
     BufferDebugCallback(&Fdo->Debug);
+    NumaDebugCallback(&Fdo->Debug);
+    ProfileDebugCallback(&Fdo->Debug);
     
     for (TargetId = 0; TargetId < XENVBD_MAX_TARGETS; ++TargetId) {
         // no need to use __FdoGetPdo (which is locked at DISPATCH) as called at HIGH_LEVEL
@@ -406,9 +526,6 @@ FdoDebugCallback(
                      "FDO: <==== Target[%-3d]    : 0x%p\n",                  
                      TargetId, Pdo);
     }
-
-    Fdo->MaximumSrbs = Fdo->CurrentSrbs;
-    Fdo->TotalSrbs = 0;
 }
 
 //=============================================================================
@@ -680,7 +797,7 @@ __FdoEnumerate(
                            Device,
                            TargetId,
                            EmulatedUnplugged,
-                           ThreadGetEvent(Fdo->FrontendThread), DeviceType);
+                           DeviceType);
         *NeedInvalidate |= (NT_SUCCESS(Status)) ? TRUE : FALSE;
     }
 }
@@ -769,41 +886,408 @@ FdoScan(
 
 __checkReturn
 static DECLSPEC_NOINLINE NTSTATUS
-FdoFrontend(
+FdoStats(
     __in PXENVBD_THREAD              Thread,
     __in PVOID                       Context
     )
 {
     PXENVBD_FDO     Fdo = Context;
+    LARGE_INTEGER   Timeout;
+    ULONG           Seconds = 0;
+
+    // runs every second to look for stuck requests, and publishes stats
+    // every StatsInterval seconds
+    Timeout.QuadPart = TIME_RELATIVE(TIME_S(1));
 
     for (;;) {
         ULONG       TargetId;
         KIRQL       Irql;
-        
-        if (!ThreadWait(Thread))
+        BOOLEAN     Powered;
+        BOOLEAN     Publish;
+
+        if (!ThreadWaitTimeout(Thread, &Timeout))
             break;
 
+        Publish = FALSE;
+        if (DriverParameters.StatsInterval != 0 &&
+            ++Seconds >= DriverParameters.StatsInterval) {
+            Seconds = 0;
+            Publish = TRUE;
+        }
+
         KeAcquireSpinLock(&Fdo->Lock, &Irql);
+        Powered = (Fdo->DevicePower == PowerDeviceD0);
+        KeReleaseSpinLock(&Fdo->Lock, Irql);
 
-        if (Fdo->DevicePower != PowerDeviceD0) {
-            KeReleaseSpinLock(&Fdo->Lock, Irql);
+        if (!Powered)
             continue;
-        }
 
         for (TargetId = 0; TargetId < XENVBD_MAX_TARGETS; ++TargetId) {
             PXENVBD_PDO Pdo = __FdoGetPdo(Fdo, TargetId);
             if (Pdo) {
-                PdoBackendPathChanged(Pdo);
+                PdoScanOutliers(Pdo);
+                if (Publish)
+                    PdoPublishStats(Pdo);
                 PdoDereference(Pdo);
             }
         }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+#define FDO_FRONTEND_INTERVAL_MIN   250     // ms
+#define FDO_FRONTEND_INTERVAL_MAX   4000    // ms
+
+__checkReturn
+static DECLSPEC_NOINLINE NTSTATUS
+FdoFrontend(
+    __in PXENVBD_THREAD              Thread,
+    __in PVOID                       Context
+    )
+{
+    PXENVBD_FDO     Fdo = Context;
+    ULONG           Interval = 0;
+
+    // Each target's backend watch only marks that target dirty, a thread
+    // cannot wait on all of them. Poll for dirty targets instead, which is
+    // a memory read per target. A target that could not be re-read stays
+    // dirty and is retried on the next pass.
+    // Backend changes are rare, so the interval backs off from 250ms to 4s
+    // while no target is dirty. With the adapter powered down or no targets
+    // there is nothing to poll, the thread sleeps until D3->D0 or a new
+    // target wakes it
+    for (;;) {
+        ULONG       TargetId;
+        ULONG       Targets;
+        BOOLEAN     Dirty;
+        KIRQL       Irql;
+        BOOLEAN     Powered;
+
+        if (Interval == 0) {
+            if (!ThreadWait(Thread))
+                break;
+        } else {
+            LARGE_INTEGER   Timeout;
+
+            Timeout.QuadPart = TIME_RELATIVE(TIME_MS(Interval));
+            if (!ThreadWaitTimeout(Thread, &Timeout))
+                break;
+        }
 
+        KeAcquireSpinLock(&Fdo->Lock, &Irql);
+        Powered = (Fdo->DevicePower == PowerDeviceD0) ? TRUE : FALSE;
         KeReleaseSpinLock(&Fdo->Lock, Irql);
+
+        // a target powering down under the walk is skipped by its frontend,
+        // which checks Active under its own lock
+        Targets = 0;
+        Dirty = FALSE;
+        for (TargetId = 0; Powered && TargetId < XENVBD_MAX_TARGETS; ++TargetId) {
+            PXENVBD_PDO Pdo = __FdoGetPdo(Fdo, TargetId);
+            if (Pdo) {
+                ++Targets;
+                if (PdoBackendPathChanged(Pdo))
+                    Dirty = TRUE;
+                PdoDereference(Pdo);
+            }
+        }
+
+        if (Targets == 0)
+            Interval = 0;
+        else if (Dirty || Interval == 0)
+            Interval = FDO_FRONTEND_INTERVAL_MIN;
+        else if (Interval < FDO_FRONTEND_INTERVAL_MAX)
+            Interval *= 2;
     }
 
     return STATUS_SUCCESS;
 }
 
+//=============================================================================
+// WMI
+#define FDO_WMI_ADAPTER_STATS   0
+#define FDO_WMI_TARGET_STATS    1
+#define FDO_WMI_TARGET_OUTLIERS 2
+
+static SCSIWMIGUIDREGINFO   FdoWmiGuidList[] = {
+    { &GUID_XENVBD_WMI_ADAPTER_STATS,   1,                  0 },
+    { &GUID_XENVBD_WMI_TARGET_STATS,    XENVBD_MAX_TARGETS, 0 },
+    { &GUID_XENVBD_WMI_TARGET_OUTLIERS, XENVBD_MAX_TARGETS, 0 },
+};
+
+static WCHAR  FdoWmiMofResourceName[] = L"MofResource";
+
+static BOOLEAN
+FdoWmiQueryRegInfo(
+    __in PVOID                      Context,
+    __in PSCSIWMI_REQUEST_CONTEXT   RequestContext,
+    __out PWCHAR*                   MofResourceName
+    )
+{
+    UNREFERENCED_PARAMETER(Context);
+    UNREFERENCED_PARAMETER(RequestContext);
+
+    // xenvbd.mof, bound into xenvbd.rc
+    *MofResourceName = FdoWmiMofResourceName;
+    return TRUE;
+}
+
+static VOID
+__FdoWmiAdapterStats(
+    __in PXENVBD_FDO                Fdo,
+    __out PXENVBD_WMI_ADAPTER_STATS Stats
+    )
+{
+    ULONG   TargetId;
+    LONG    CurrentSrbs;
+    LONG64  TotalSrbs;
+
+    RtlZeroMemory(Stats, sizeof(XENVBD_WMI_ADAPTER_STATS));
+
+    for (TargetId = 0; TargetId < XENVBD_MAX_TARGETS; ++TargetId) {
+        if (Fdo->Targets[TargetId])
+            ++Stats->Targets;
+    }
+    __FdoSrbCounts(Fdo, &CurrentSrbs, &TotalSrbs);
+    Stats->CurrentSrbs  = (ULONG)CurrentSrbs;
+    Stats->MaximumSrbs  = (ULONG)Fdo->MaximumSrbs;
+    Stats->Version      = XENVBD_WMI_VERSION;
+    Stats->TotalSrbs    = (ULONG64)TotalSrbs;
+    Stats->MemoryUsed   = (ULONG64)Fdo->MemoryUsed;
+    Stats->MemoryMaximum = (ULONG64)Fdo->MemoryMaximum;
+    Stats->MemoryBudget = (ULONG64)DriverParameters.MemoryBudget << PAGE_SHIFT;
+    Stats->MemoryRefused = Fdo->MemoryRefused;
+}
+
+static VOID
+__FdoWmiTargetStats(
+    __in PXENVBD_FDO                Fdo,
+    __in ULONG                      TargetId,
+    __out PXENVBD_WMI_TARGET_STATS  Stats
+    )
+{
+    PXENVBD_PDO Pdo;
+
+    RtlZeroMemory(Stats, sizeof(XENVBD_WMI_TARGET_STATS));
+    Stats->TargetId = TargetId;
+
+    Pdo = __FdoGetPdo(Fdo, TargetId);
+    if (Pdo == NULL)
+        return;
+
+    PdoQueryWmiStats(Pdo, Stats);
+    PdoDereference(Pdo);
+}
+
+static VOID
+__FdoWmiTargetOutliers(
+    __in PXENVBD_FDO                    Fdo,
+    __in ULONG                          TargetId,
+    __out PXENVBD_WMI_TARGET_OUTLIERS   Outliers
+    )
+{
+    PXENVBD_PDO Pdo;
+
+    RtlZeroMemory(Outliers, sizeof(XENVBD_WMI_TARGET_OUTLIERS));
+    Outliers->TargetId = TargetId;
+
+    Pdo = __FdoGetPdo(Fdo, TargetId);
+    if (Pdo == NULL)
+        return;
+
+    PdoQueryWmiOutliers(Pdo, Outliers);
+    PdoDereference(Pdo);
+}
+
+static BOOLEAN
+FdoWmiQueryDataBlock(
+    __in PVOID                      Context,
+    __in PSCSIWMI_REQUEST_CONTEXT   RequestContext,
+    __in ULONG                      GuidIndex,
+    __in ULONG                      InstanceIndex,
+    __in ULONG                      InstanceCount,
+    __inout PULONG                  InstanceLengthArray,
+    __in ULONG                      BufferAvail,
+    __out PUCHAR                    Buffer
+    )
+{
+    PXENVBD_FDO Fdo = Context;
+    ULONG       Size;
+    ULONG       Index;
+    UCHAR       Status;
+
+    switch (GuidIndex) {
+    case FDO_WMI_ADAPTER_STATS:
+        Size = sizeof(XENVBD_WMI_ADAPTER_STATS);
+        Status = SRB_STATUS_DATA_OVERRUN;
+        if (BufferAvail < Size)
+            break;
+
+        __FdoWmiAdapterStats(Fdo, (PXENVBD_WMI_ADAPTER_STATS)Buffer);
+        InstanceLengthArray[0] = Size;
+        Status = SRB_STATUS_SUCCESS;
+        break;
+
+    case FDO_WMI_TARGET_STATS:
+        Size = InstanceCount * sizeof(XENVBD_WMI_TARGET_STATS);
+        Status = SRB_STATUS_DATA_OVERRUN;
+        if (BufferAvail < Size)
+            break;
+
+        for (Index = 0; Index < InstanceCount; ++Index) {
+            __FdoWmiTargetStats(Fdo,
+                                InstanceIndex + Index,
+                                (PXENVBD_WMI_TARGET_STATS)Buffer + Index);
+            InstanceLengthArray[Index] = sizeof(XENVBD_WMI_TARGET_STATS);
+        }
+        Status = SRB_STATUS_SUCCESS;
+        break;
+
+    case FDO_WMI_TARGET_OUTLIERS:
+        Size = InstanceCount * sizeof(XENVBD_WMI_TARGET_OUTLIERS);
+        Status = SRB_STATUS_DATA_OVERRUN;
+        if (BufferAvail < Size)
+            break;
+
+        for (Index = 0; Index < InstanceCount; ++Index) {
+            __FdoWmiTargetOutliers(Fdo,
+                                   InstanceIndex + Index,
+                                   (PXENVBD_WMI_TARGET_OUTLIERS)Buffer + Index);
+            InstanceLengthArray[Index] = sizeof(XENVBD_WMI_TARGET_OUTLIERS);
+        }
+        Status = SRB_STATUS_SUCCESS;
+        break;
+
+    default:
+        Size = 0;
+        Status = SRB_STATUS_ERROR;
+        break;
+    }
+
+    ScsiPortWmiPostProcess(RequestContext, Status, Size);
+    return FALSE;   // not pending
+}
+
+static FORCEINLINE VOID
+__FdoWmiInitialize(
+    __in PXENVBD_FDO                 Fdo
+    )
+{
+    PSCSI_WMILIB_CONTEXT    WmiLibContext = &Fdo->WmiLibContext;
+
+    RtlZeroMemory(WmiLibContext, sizeof(SCSI_WMILIB_CONTEXT));
+    WmiLibContext->GuidCount            = ARRAYSIZE(FdoWmiGuidList);
+    WmiLibContext->GuidList             = FdoWmiGuidList;
+    WmiLibContext->QueryWmiRegInfo      = FdoWmiQueryRegInfo;
+    WmiLibContext->QueryWmiDataBlock    = FdoWmiQueryDataBlock;
+}
+
+static FORCEINLINE VOID
+__FdoWmiRequest(
+    __in PXENVBD_FDO                 Fdo,
+    __in PSCSI_REQUEST_BLOCK         Srb
+    )
+{
+    PSCSI_WMI_REQUEST_BLOCK WmiSrb = (PSCSI_WMI_REQUEST_BLOCK)Srb;
+    SCSIWMI_REQUEST_CONTEXT RequestContext;
+    BOOLEAN                 Pending;
+
+    // only adapter data blocks are registered, targets are instances
+    if (!(WmiSrb->WMIFlags & SRB_WMI_FLAGS_ADAPTER_REQUEST)) {
+        Srb->DataTransferLength = 0;
+        Srb->SrbStatus = SRB_STATUS_INVALID_REQUEST;
+        return;
+    }
+
+    RtlZeroMemory(&RequestContext, sizeof(RequestContext));
+    RequestContext.UserContext = Srb;
+
+    Pending = ScsiPortWmiDispatchFunction(&Fdo->WmiLibContext,
+                                          WmiSrb->WMISubFunction,
+                                          Fdo,
+                                          &RequestContext,
+                                          WmiSrb->DataPath,
+                                          WmiSrb->DataBufferLength,
+                                          WmiSrb->DataBuffer);
+    ASSERT(!Pending);
+    UNREFERENCED_PARAMETER(Pending);
+
+    Srb->DataTransferLength = ScsiPortWmiGetReturnSize(&RequestContext);
+    Srb->SrbStatus = ScsiPortWmiGetReturnStatus(&RequestContext);
+}
+
+//=============================================================================
+// IOCTL_SCSI_MINIPORT
+static VOID
+__FdoReadTrace(
+    __in PXENVBD_FDO                 Fdo,
+    __in PSCSI_REQUEST_BLOCK         Srb
+    )
+{
+    PXENVBD_IOTRACE_READ_BUFFER Buffer = Srb->DataBuffer;
+    ULONG                       Length;
+    ULONG                       Maximum;
+    PXENVBD_PDO                 Pdo;
+
+    Length = sizeof(SRB_IO_CONTROL) + Buffer->Header.Length;
+    if (Length > Srb->DataTransferLength ||
+        Length < sizeof(XENVBD_IOTRACE_READ_BUFFER)) {
+        Buffer->Header.ReturnCode = (ULONG)STATUS_BUFFER_TOO_SMALL;
+        Srb->SrbStatus = SRB_STATUS_DATA_OVERRUN;
+        return;
+    }
+
+    Maximum = 1 + (Length - sizeof(XENVBD_IOTRACE_READ_BUFFER)) /
+                    sizeof(XENVBD_IOTRACE_RECORD);
+
+    Buffer->Count = 0;
+    Buffer->Sequence = 0;
+
+    Pdo = (Buffer->TargetId < XENVBD_MAX_TARGETS) ?
+                __FdoGetPdo(Fdo, Buffer->TargetId) : NULL;
+    if (Pdo == NULL) {
+        Buffer->Header.ReturnCode = (ULONG)STATUS_NO_SUCH_DEVICE;
+        Srb->SrbStatus = SRB_STATUS_SUCCESS;
+        return;
+    }
+
+    PdoReadTrace(Pdo, Buffer->Records, Maximum, &Buffer->Count, &Buffer->Sequence);
+    PdoDereference(Pdo);
+
+    Buffer->Header.ReturnCode = (ULONG)STATUS_SUCCESS;
+    Srb->SrbStatus = SRB_STATUS_SUCCESS;
+}
+
+static FORCEINLINE VOID
+__FdoIoControl(
+    __in PXENVBD_FDO                 Fdo,
+    __in PSCSI_REQUEST_BLOCK         Srb
+    )
+{
+    PSRB_IO_CONTROL Header = Srb->DataBuffer;
+
+    Srb->SrbStatus = SRB_STATUS_INVALID_REQUEST;
+
+    if (Header == NULL || Srb->DataTransferLength < sizeof(SRB_IO_CONTROL))
+        return;
+
+    if (RtlCompareMemory(Header->Signature,
+                         XENVBD_IOTRACE_SIGNATURE,
+                         sizeof(Header->Signature)) != sizeof(Header->Signature))
+        return;
+
+    switch (Header->ControlCode) {
+    case XENVBD_IOTRACE_READ:
+        __FdoReadTrace(Fdo, Srb);
+        break;
+
+    default:
+        Header->ReturnCode = (ULONG)STATUS_INVALID_DEVICE_REQUEST;
+        break;
+    }
+}
+
 //=============================================================================
 // Initialize, Start, Stop
 
@@ -1372,6 +1856,224 @@ FdoSuspendLateCallback(
 
     Status = __FdoD3ToD0(Fdo);
     ASSERT(NT_SUCCESS(Status));
+
+    // targets reconnect to their new backends from the resume thread
+    ThreadWake(Fdo->ResumeThread);
+}
+
+__checkReturn
+static DECLSPEC_NOINLINE NTSTATUS
+FdoTargetWork(
+    __in PXENVBD_THREAD             Thread,
+    __in PVOID                      Context
+    )
+{
+    PXENVBD_TARGET_WORK Work = Context;
+
+    UNREFERENCED_PARAMETER(Thread);
+
+    Work->Status = Work->Function(Work->Pdo);
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS
+__FdoForEachTarget(
+    __in PXENVBD_FDO             Fdo,
+    __in XENVBD_TARGET_FUNCTION  Function,
+    __in PCHAR                   Name
+    )
+{
+    PXENVBD_TARGET_WORK Work;
+    NTSTATUS            Status;
+    ULONG               TargetId;
+
+    Work = __AllocateNonPagedPoolWithTag(__FUNCTION__, __LINE__,
+                                         sizeof(XENVBD_TARGET_WORK) * XENVBD_MAX_TARGETS,
+                                         FDO_SIGNATURE);
+    if (Work == NULL) {
+        // one target after another
+        Status = STATUS_SUCCESS;
+        for (TargetId = 0; TargetId < XENVBD_MAX_TARGETS; ++TargetId) {
+            PXENVBD_PDO Pdo = __FdoGetPdo(Fdo, TargetId);
+            NTSTATUS    TargetStatus;
+
+            if (Pdo == NULL)
+                continue;
+
+            TargetStatus = Function(Pdo);
+            if (!NT_SUCCESS(TargetStatus)) {
+                Error("Target[%d] : %s failed (%08x)\n", TargetId, Name, TargetStatus);
+                if (NT_SUCCESS(Status))
+                    Status = TargetStatus;
+            }
+
+            PdoDereference(Pdo);
+        }
+
+        return Status;
+    }
+
+    // Start every target's backend handshake before waiting for any of
+    // them. Each frontend sleeps on its own backend watch, so the targets
+    // come up in parallel rather than one handshake after another.
+    for (TargetId = 0; TargetId < XENVBD_MAX_TARGETS; ++TargetId) {
+        PXENVBD_TARGET_WORK Target = &Work[TargetId];
+
+        Target->Pdo = __FdoGetPdo(Fdo, TargetId);
+        if (Target->Pdo == NULL)
+            continue;
+
+        Target->Function = Function;
+
+        Status = STATUS_UNSUCCESSFUL;
+        if (KeGetCurrentIrql() == PASSIVE_LEVEL)
+            Status = ThreadCreate(FdoTargetWork, Target, &Target->Thread);
+
+        if (!NT_SUCCESS(Status))
+            Target->Status = Function(Target->Pdo);
+    }
+
+    Status = STATUS_SUCCESS;
+    for (TargetId = 0; TargetId < XENVBD_MAX_TARGETS; ++TargetId) {
+        PXENVBD_TARGET_WORK Target = &Work[TargetId];
+
+        if (Target->Pdo == NULL)
+            continue;
+
+        if (Target->Thread != NULL)
+            ThreadJoin(Target->Thread);
+
+        if (!NT_SUCCESS(Target->Status)) {
+            Error("Target[%d] : %s failed (%08x)\n", TargetId, Name, Target->Status);
+            if (NT_SUCCESS(Status))
+                Status = Target->Status;
+        }
+
+        PdoDereference(Target->Pdo);
+    }
+
+    __FreePoolWithTag(Work, FDO_SIGNATURE);
+
+    return Status;
+}
+
+__checkReturn
+static DECLSPEC_NOINLINE NTSTATUS
+FdoResume(
+    __in PXENVBD_THREAD             Thread,
+    __in PVOID                      Context
+    )
+{
+    PXENVBD_FDO     Fdo = Context;
+
+    for (;;) {
+        KIRQL   Irql;
+        BOOLEAN Powered;
+
+        if (!ThreadWait(Thread))
+            break;
+
+        KeAcquireSpinLock(&Fdo->Lock, &Irql);
+        Powered = (Fdo->DevicePower == PowerDeviceD0) ? TRUE : FALSE;
+        KeReleaseSpinLock(&Fdo->Lock, Irql);
+
+        if (!Powered)
+            continue;
+
+        (VOID) __FdoForEachTarget(Fdo, PdoResume, "Resume");
+    }
+
+    return STATUS_SUCCESS;
+}
+
+// StorPort resumes the adapter itself if a bus reset takes longer (s)
+#define FDO_RESET_PAUSE     300
+
+static VOID
+__FdoResetTargets(
+    __in PXENVBD_FDO            Fdo,
+    __in PSCSI_REQUEST_BLOCK    Srb
+    )
+{
+    ULONG           TargetId;
+    ULONG           Last = XENVBD_MAX_TARGETS;
+
+    TargetId = 0;
+    if (Srb != NULL && Srb->Function == SRB_FUNCTION_RESET_DEVICE) {
+        // a device reset only drains its own target
+        TargetId = Srb->TargetId;
+        Last = TargetId + 1;
+    }
+
+    for (; TargetId < Last; ++TargetId) {
+        PXENVBD_PDO Pdo = __FdoGetPdo(Fdo, TargetId);
+        if (Pdo) {
+            PdoReset(Pdo);
+            PdoDereference(Pdo);
+        }
+    }
+}
+
+__checkReturn
+static DECLSPEC_NOINLINE NTSTATUS
+FdoReset(
+    __in PXENVBD_THREAD             Thread,
+    __in PVOID                      Context
+    )
+{
+    PXENVBD_FDO     Fdo = Context;
+
+    for (;;) {
+        KIRQL   Irql;
+        BOOLEAN Powered;
+
+        if (!ThreadWait(Thread))
+            break;
+
+        KeAcquireSpinLock(&Fdo->Lock, &Irql);
+        Powered = (Fdo->DevicePower == PowerDeviceD0) ? TRUE : FALSE;
+        KeReleaseSpinLock(&Fdo->Lock, Irql);
+
+        // a reset after this point needs another pass, so clear it first
+        if (InterlockedExchange(&Fdo->ResetBus, 0)) {
+            Verbose("====> Bus Reset\n");
+            if (Powered)
+                __FdoResetTargets(Fdo, NULL);
+            StorPortResume(Fdo);
+            Verbose("<==== Bus Reset\n");
+        }
+
+        for (;;) {
+            PXENVBD_SRBEXT      SrbExt;
+            PSCSI_REQUEST_BLOCK Srb;
+            PLIST_ENTRY         Entry = QueuePop(&Fdo->ResetSrbs);
+            if (Entry == NULL)
+                break;
+            SrbExt = CONTAINING_RECORD(Entry, XENVBD_SRBEXT, Entry);
+            Srb = SrbExt->Srb;
+
+            if (Powered)
+                __FdoResetTargets(Fdo, Srb);
+
+            Srb->SrbStatus = SRB_STATUS_SUCCESS;
+            FdoCompleteSrb(Fdo, Srb);
+        }
+    }
+
+    // nothing can queue a reset once the thread is stopped
+    for (;;) {
+        PXENVBD_SRBEXT  SrbExt;
+        PLIST_ENTRY     Entry = QueuePop(&Fdo->ResetSrbs);
+        if (Entry == NULL)
+            break;
+        SrbExt = CONTAINING_RECORD(Entry, XENVBD_SRBEXT, Entry);
+
+        SrbExt->Srb->SrbStatus = SRB_STATUS_ABORTED;
+        FdoCompleteSrb(Fdo, SrbExt->Srb);
+    }
+
+    return STATUS_SUCCESS;
 }
 
 static NTSTATUS
@@ -1405,16 +2107,9 @@ FdoD3ToD0(
         goto fail2;
 
     // Power UP any PDOs
-    for (TargetId = 0; TargetId < XENVBD_MAX_TARGETS; ++TargetId) {
-        PXENVBD_PDO Pdo = __FdoGetPdo(Fdo, TargetId);
-        if (Pdo) {
-            Status = PdoD3ToD0(Pdo);
-            PdoDereference(Pdo);
-
-            if (!NT_SUCCESS(Status))
-                goto fail3;
-        }
-    }
+    Status = __FdoForEachTarget(Fdo, PdoD3ToD0, "D3->D0");
+    if (!NT_SUCCESS(Status))
+        goto fail3;
 
     Status = __FdoD3ToD0(Fdo);
     if (!NT_SUCCESS(Status))
@@ -1431,6 +2126,9 @@ FdoD3ToD0(
     if (!NT_SUCCESS(Status))
         goto fail5;
 
+    // the frontend thread sleeps while powered down
+    ThreadWake(Fdo->FrontendThread);
+
     Trace("<===== (%d)\n", KeGetCurrentIrql());
     return STATUS_SUCCESS;
 
@@ -1618,16 +2316,49 @@ __FdoInitialize(
     if (!NT_SUCCESS(Status))
         goto fail5;
 
+    Status = ThreadCreate(FdoResume, Fdo, &Fdo->ResumeThread);
+    if (!NT_SUCCESS(Status))
+        goto fail6;
+
+    QueueInit(&Fdo->ResetSrbs);
+    Status = ThreadCreate(FdoReset, Fdo, &Fdo->ResetThread);
+    if (!NT_SUCCESS(Status))
+        goto fail7;
+
+    if (DriverParameters.StatsInterval != 0 ||
+        DriverParameters.SlowThreshold != 0) {
+        Status = ThreadCreate(FdoStats, Fdo, &Fdo->StatsThread);
+        if (!NT_SUCCESS(Status))
+            goto fail8;
+    }
+
     // query enumerator
     // fix this up to query from device location(?)
     //RtlInitAnsiString(&Fdo->Enumerator, "vbd");
 
+    __FdoWmiInitialize(Fdo);
+
     // link fdo
     DriverLinkFdo(Fdo);
 
     Trace("<===== (%d)\n", KeGetCurrentIrql());
     return STATUS_SUCCESS;
 
+fail8:
+    Error("fail8\n");
+    ThreadAlert(Fdo->ResetThread);
+    ThreadJoin(Fdo->ResetThread);
+    Fdo->ResetThread = NULL;
+fail7:
+    Error("fail7\n");
+    ThreadAlert(Fdo->ResumeThread);
+    ThreadJoin(Fdo->ResumeThread);
+    Fdo->ResumeThread = NULL;
+fail6:
+    Error("fail6\n");
+    ThreadAlert(Fdo->DevicePowerThread);
+    ThreadJoin(Fdo->DevicePowerThread);
+    Fdo->DevicePowerThread = NULL;
 fail5:
     Error("fail5\n");
     ThreadAlert(Fdo->FrontendThread);
@@ -1670,6 +2401,23 @@ __FdoTerminate(
     KeWaitForSingleObject(&Fdo->RemoveEvent, Executive, KernelMode, FALSE, NULL);
     ASSERT3S(Fdo->ReferenceCount, ==, 0);
 
+    // stop stats thread
+    if (Fdo->StatsThread) {
+        ThreadAlert(Fdo->StatsThread);
+        ThreadJoin(Fdo->StatsThread);
+        Fdo->StatsThread = NULL;
+    }
+
+    // stop reset thread
+    ThreadAlert(Fdo->ResetThread);
+    ThreadJoin(Fdo->ResetThread);
+    Fdo->ResetThread = NULL;
+
+    // stop resume thread
+    ThreadAlert(Fdo->ResumeThread);
+    ThreadJoin(Fdo->ResumeThread);
+    Fdo->ResumeThread = NULL;
+
     // stop device power thread
     ThreadAlert(Fdo->DevicePowerThread);
     ThreadJoin(Fdo->DevicePowerThread);
@@ -1712,7 +2460,15 @@ __FdoTerminate(
 
     Fdo->Signature = 0;
     Fdo->DevicePower = 0;
-    Fdo->CurrentSrbs = Fdo->MaximumSrbs = Fdo->TotalSrbs = 0;
+    Fdo->MaximumSrbs = 0;
+    Fdo->MemoryMaximum = Fdo->MemoryRefused = Fdo->MemoryReclaims = 0;
+    Fdo->MemoryWakes = Fdo->MemoryReclaimTime = 0;
+    Fdo->MemoryWaiters = 0;
+    RtlZeroMemory(Fdo->MemoryWaiting, sizeof(Fdo->MemoryWaiting));
+    Fdo->ResetBus = 0;
+    RtlZeroMemory(&Fdo->ResetSrbs, sizeof(XENVBD_QUEUE));
+    RtlZeroMemory(Fdo->Cpu, sizeof(Fdo->Cpu));
+    RtlZeroMemory(&Fdo->WmiLibContext, sizeof(SCSI_WMILIB_CONTEXT));
     RtlZeroMemory(&Fdo->Enumerator, sizeof(ANSI_STRING));
     RtlZeroMemory(&Fdo->TargetLock, sizeof(KSPIN_LOCK));
     RtlZeroMemory(&Fdo->Lock, sizeof(KSPIN_LOCK));
@@ -1761,14 +2517,9 @@ FdoStartSrb(
     __in PSCSI_REQUEST_BLOCK         Srb
     )
 {
-    LONG    Value;
-
     UNREFERENCED_PARAMETER(Srb);
 
-    Value = InterlockedIncrement(&Fdo->CurrentSrbs);
-    if (Value > Fdo->MaximumSrbs)
-        Fdo->MaximumSrbs = Value;
-    InterlockedIncrement(&Fdo->TotalSrbs);
+    InterlockedIncrement64(&__FdoCpu(Fdo)->StartedSrbs);
 }
 
 FORCEINLINE VOID
@@ -1779,30 +2530,39 @@ FdoCompleteSrb(
 {
     ASSERT3U(Srb->SrbStatus, !=, SRB_STATUS_PENDING);
 
-    InterlockedDecrement(&Fdo->CurrentSrbs);
+    InterlockedIncrement64(&__FdoCpu(Fdo)->CompletedSrbs);
 
-    StorPortNotification(RequestComplete, Fdo, Srb);
+    EtwSrbComplete(Srb);
+    PROFILE(ProfileComplete,
+            StorPortNotification(RequestComplete, Fdo, Srb));
 }
 
 //=============================================================================
 // StorPort Methods
+VOID
+FdoQueueReset(
+    __in PXENVBD_FDO                 Fdo,
+    __in PSCSI_REQUEST_BLOCK         Srb
+    )
+{
+    PXENVBD_SRBEXT  SrbExt = GetSrbExt(Srb);
+
+    QueueAppend(&Fdo->ResetSrbs, &SrbExt->Entry);
+    ThreadWake(Fdo->ResetThread);
+}
+
 BOOLEAN
 FdoResetBus(
     __in PXENVBD_FDO                 Fdo
     )
 {
-    ULONG           TargetId;
-
-    Verbose("====>\n");
-    for (TargetId = 0; TargetId < XENVBD_MAX_TARGETS; ++TargetId) {
-        PXENVBD_PDO Pdo = __FdoGetPdo(Fdo, TargetId);
-        if (Pdo) {
-            PdoReset(Pdo);
-            PdoDereference(Pdo);
-        }
-    }
-    Verbose("<====\n");
+    // draining the targets can take minutes, which cannot be spent at
+    // DISPATCH_LEVEL here. Hold new requests off until the reset thread
+    // has reset every target
+    if (InterlockedExchange(&Fdo->ResetBus, 1) == 0)
+        (VOID) StorPortPause(Fdo, FDO_RESET_PAUSE);
 
+    ThreadWake(Fdo->ResetThread);
     return TRUE;
 }
 
@@ -1883,7 +2643,7 @@ FdoFindAdapter(
     ConfigInfo->MapBuffers                  = STOR_MAP_NON_READ_WRITE_BUFFERS;
     ConfigInfo->MaximumNumberOfTargets      = XENVBD_MAX_TARGETS;
     ConfigInfo->MaximumNumberOfLogicalUnits = 1;
-    ConfigInfo->WmiDataProvider             = FALSE; // should be TRUE
+    ConfigInfo->WmiDataProvider             = TRUE;
     ConfigInfo->SynchronizationModel        = StorSynchronizeFullDuplex;
 
     if (ConfigInfo->Dma64BitAddresses == SCSI_DMA64_SYSTEM_SUPPORTED) {
@@ -1932,8 +2692,15 @@ FdoBuildIo(
         Srb->SrbStatus = SRB_STATUS_ABORT_FAILED;
         break;
     case SRB_FUNCTION_RESET_BUS:
-        Srb->SrbStatus = SRB_STATUS_SUCCESS;
-        FdoResetBus(Fdo);
+        // completed by the reset thread, not StartIo
+        FdoStartSrb(Fdo, Srb);
+        FdoQueueReset(Fdo, Srb);
+        return FALSE;
+    case SRB_FUNCTION_WMI:
+        __FdoWmiRequest(Fdo, Srb);
+        break;
+    case SRB_FUNCTION_IO_CONTROL:
+        __FdoIoControl(Fdo, Srb);
         break;
         
     default:
@@ -2222,6 +2989,262 @@ FdoDispatchPower(
     return status;
 }
 
+//=============================================================================
+// Ring Budget
+ULONG
+FdoAcquireRingPages(
+    __in PXENVBD_FDO    Fdo,
+    __in ULONG          Order
+    )
+{
+    const LONG          Budget = (LONG)DriverParameters.RingPageBudget;
+
+    for (;;) {
+        LONG    Used = Fdo->RingPages;
+        ULONG   Granted = Order;
+
+        // a single page is always granted, so every target can connect
+        if (Budget != 0) {
+            while (Granted != 0 && Used + (1l << Granted) > Budget)
+                --Granted;
+        }
+
+        if (InterlockedCompareExchange(&Fdo->RingPages,
+                                       Used + (1l << Granted),
+                                       Used) == Used)
+            return Granted;
+    }
+}
+
+VOID
+FdoReleaseRingPages(
+    __in PXENVBD_FDO    Fdo,
+    __in ULONG          Order
+    )
+{
+    LONG                Used;
+
+    Used = InterlockedExchangeAdd(&Fdo->RingPages, -(1l << Order));
+    ASSERT3S(Used, >=, (1l << Order));
+}
+
+//=============================================================================
+// Memory Budget
+
+// Refusals walk every target for idle credit at most this often (100ns units)
+#define FDO_MEMORY_RECLAIM_INTERVAL     TIME_MS(10)
+
+static BOOLEAN
+__FdoTryAcquireMemory(
+    __in PXENVBD_FDO    Fdo,
+    __in LONG64         Held,
+    __in LONG64         Bytes,
+    __in BOOLEAN        Idle
+    )
+{
+    const LONG64        Budget = (LONG64)DriverParameters.MemoryBudget << PAGE_SHIFT;
+    LONG64              Share;
+    LONG64              Limit;
+    LONG64              Used;
+    LONG                Targets;
+
+    Targets = Fdo->MemoryTargets;
+    Share = Budget / ((Targets > 0) ? Targets : 1);
+
+    // beyond its share a target may only borrow while a share's worth is
+    // still free, so a target that becomes busy can always get started
+    Limit = Budget;
+    if (Held + Bytes > Share)
+        Limit = (Budget > Share) ? Budget - Share : 0;
+
+    for (;;) {
+        Used = Fdo->MemoryUsed;
+
+        if (Budget != 0 && !Idle && Used + Bytes > Limit)
+            return FALSE;
+
+        if (InterlockedCompareExchange64(&Fdo->MemoryUsed,
+                                         Used + Bytes,
+                                         Used) == Used)
+            break;
+    }
+
+    if (Used + Bytes > Fdo->MemoryMaximum)
+        Fdo->MemoryMaximum = Used + Bytes;
+    if (Held == 0)
+        InterlockedIncrement(&Fdo->MemoryTargets);
+
+    return TRUE;
+}
+
+static VOID
+__FdoReclaimMemory(
+    __in PXENVBD_FDO    Fdo
+    )
+{
+    ULONG               TargetId;
+    LONG64              Now = (LONG64)KeQueryInterruptTime();
+    LONG64              Last = Fdo->MemoryReclaimTime;
+
+    // refusals come from the I/O path and all run into each other while
+    // the budget is tight, so only one walk per interval does the work.
+    // A refused target waits and retries, so it is not left behind
+    if (Now - Last < FDO_MEMORY_RECLAIM_INTERVAL)
+        return;
+    if (InterlockedCompareExchange64(&Fdo->MemoryReclaimTime, Now, Last) != Last)
+        return;
+
+    ++Fdo->MemoryReclaims;
+
+    for (TargetId = 0; TargetId < XENVBD_MAX_TARGETS; ++TargetId) {
+        PXENVBD_PDO Pdo = __FdoGetPdo(Fdo, TargetId);
+        if (Pdo == NULL)
+            continue;
+
+        PdoReclaimMemory(Pdo);
+        PdoDereference(Pdo);
+    }
+}
+
+static VOID
+__FdoWakeMemory(
+    __in PXENVBD_FDO    Fdo
+    )
+{
+    ULONG               Index;
+
+    ++Fdo->MemoryWakes;
+
+    // take each word of waiters in one go and only visit the targets in it
+    for (Index = 0; Index < ARRAYSIZE(Fdo->MemoryWaiting); ++Index) {
+        ULONG   Waiting;
+        ULONG   Bit;
+
+        if (Fdo->MemoryWaiting[Index] == 0)
+            continue;
+
+        Waiting = (ULONG)InterlockedExchange(&Fdo->MemoryWaiting[Index], 0);
+
+        while (_BitScanForward(&Bit, Waiting)) {
+            PXENVBD_PDO Pdo;
+
+            Waiting &= ~(1ul << Bit);
+            InterlockedDecrement(&Fdo->MemoryWaiters);
+
+            Pdo = __FdoGetPdo(Fdo, (Index * 32) + Bit);
+            if (Pdo == NULL)
+                continue;
+
+            PdoKickRequests(Pdo);
+            PdoDereference(Pdo);
+        }
+    }
+}
+
+BOOLEAN
+FdoAcquireMemory(
+    __in PXENVBD_FDO    Fdo,
+    __in LONG64         Held,
+    __in LONG64         Bytes,
+    __in BOOLEAN        Idle
+    )
+{
+    if (__FdoTryAcquireMemory(Fdo, Held, Bytes, Idle))
+        return TRUE;
+
+    // idle targets may be sitting on credit they no longer use
+    __FdoReclaimMemory(Fdo);
+
+    if (__FdoTryAcquireMemory(Fdo, Held, Bytes, Idle))
+        return TRUE;
+
+    ++Fdo->MemoryRefused;
+    return FALSE;
+}
+
+VOID
+FdoReleaseMemory(
+    __in PXENVBD_FDO    Fdo,
+    __in LONG64         Held,
+    __in LONG64         Bytes
+    )
+{
+    LONG64              Used;
+
+    Used = InterlockedExchangeAdd64(&Fdo->MemoryUsed, -Bytes);
+    ASSERT3S(Used, >=, Bytes);
+
+    if (Held == Bytes)
+        InterlockedDecrement(&Fdo->MemoryTargets);
+
+    if (Fdo->MemoryWaiters != 0)
+        __FdoWakeMemory(Fdo);
+}
+
+BOOLEAN
+FdoChargeMemory(
+    __in PXENVBD_FDO    Fdo,
+    __in LONG64         Bytes,
+    __in BOOLEAN        Force
+    )
+{
+    const LONG64        Budget = (LONG64)DriverParameters.MemoryBudget << PAGE_SHIFT;
+    LONG64              Used;
+
+    for (;;) {
+        Used = Fdo->MemoryUsed;
+
+        if (Budget != 0 && !Force && Used + Bytes > Budget)
+            return FALSE;
+
+        if (InterlockedCompareExchange64(&Fdo->MemoryUsed,
+                                         Used + Bytes,
+                                         Used) == Used)
+            break;
+    }
+
+    if (Used + Bytes > Fdo->MemoryMaximum)
+        Fdo->MemoryMaximum = Used + Bytes;
+
+    return TRUE;
+}
+
+VOID
+FdoUnchargeMemory(
+    __in PXENVBD_FDO    Fdo,
+    __in LONG64         Bytes
+    )
+{
+    LONG64              Used;
+
+    Used = InterlockedExchangeAdd64(&Fdo->MemoryUsed, -Bytes);
+    ASSERT3S(Used, >=, Bytes);
+
+    if (Fdo->MemoryWaiters != 0)
+        __FdoWakeMemory(Fdo);
+}
+
+VOID
+FdoWaitForMemory(
+    __in PXENVBD_FDO    Fdo,
+    __in ULONG          TargetId
+    )
+{
+    ASSERT3U(TargetId, <, XENVBD_MAX_TARGETS);
+
+    if (!InterlockedBitTestAndSet(&Fdo->MemoryWaiting[TargetId / 32],
+                                  TargetId % 32))
+        InterlockedIncrement(&Fdo->MemoryWaiters);
+}
+
+BOOLEAN
+FdoIsWaitingForMemory(
+    __in PXENVBD_FDO    Fdo
+    )
+{
+    return (Fdo->MemoryWaiters != 0) ? TRUE : FALSE;
+}
+
 //=============================================================================
 // Interfaces
 PXENBUS_STORE_INTERFACE
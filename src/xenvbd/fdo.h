@@ -103,6 +103,14 @@ FdoCompleteSrb(
     __in PSCSI_REQUEST_BLOCK         Srb
     );
 
+// Queues a bus or device reset SRB for the reset thread, which completes
+// it once its targets have been drained and reconnected at PASSIVE_LEVEL
+extern VOID
+FdoQueueReset(
+    __in PXENVBD_FDO                 Fdo,
+    __in PSCSI_REQUEST_BLOCK         Srb
+    );
+
 // StorPort Methods
 extern BOOLEAN
 FdoResetBus(
@@ -167,6 +175,73 @@ FdoDispatchPower(
     __in PIRP                        Irp
     );
 
+// Ring Budget
+// Takes up to 2^Order ring pages from DriverParameters.RingPageBudget and
+// returns the order actually granted
+extern ULONG
+FdoAcquireRingPages(
+    __in PXENVBD_FDO                 Fdo,
+    __in ULONG                       Order
+    );
+
+extern VOID
+FdoReleaseRingPages(
+    __in PXENVBD_FDO                 Fdo,
+    __in ULONG                       Order
+    );
+
+// Memory Budget
+// Credits Bytes of data path memory to a target already holding Held bytes,
+// against DriverParameters.MemoryBudget shared fairly by the targets
+// holding credit. Reclaims unused credit from all targets before refusing.
+// An Idle target (nothing in use) is never refused, so it can make progress
+__checkReturn
+extern BOOLEAN
+FdoAcquireMemory(
+    __in PXENVBD_FDO                 Fdo,
+    __in LONG64                      Held,
+    __in LONG64                      Bytes,
+    __in BOOLEAN                     Idle
+    );
+
+// Held includes Bytes, the target holds no credit once Held == Bytes.
+// Kicks any target waiting for memory
+extern VOID
+FdoReleaseMemory(
+    __in PXENVBD_FDO                 Fdo,
+    __in LONG64                      Held,
+    __in LONG64                      Bytes
+    );
+
+// Charges Bytes held for the lifetime of a target (its stats) against the
+// budget without counting the target as holding credit. Refused if it does
+// not fit, unless Force
+__checkReturn
+extern BOOLEAN
+FdoChargeMemory(
+    __in PXENVBD_FDO                 Fdo,
+    __in LONG64                      Bytes,
+    __in BOOLEAN                     Force
+    );
+
+extern VOID
+FdoUnchargeMemory(
+    __in PXENVBD_FDO                 Fdo,
+    __in LONG64                      Bytes
+    );
+
+// Queues TargetId to be kicked the next time credit is returned
+extern VOID
+FdoWaitForMemory(
+    __in PXENVBD_FDO                 Fdo,
+    __in ULONG                       TargetId
+    );
+
+extern BOOLEAN
+FdoIsWaitingForMemory(
+    __in PXENVBD_FDO                 Fdo
+    );
+
 // Interfaces
 extern PXENBUS_STORE_INTERFACE
 FdoAcquireStore(
@@ -55,14 +55,26 @@ struct _XENVBD_FRONTEND {
     PCHAR                       BackendPath;
     PCHAR                       TargetPath;
     USHORT                      BackendId;
+    XENVBD_NUMA_PLACEMENT       Placement;
     XENVBD_STATE                State;
+    XENVBD_STATE                ResumeState;
     KSPIN_LOCK                  StateLock;
+    KIRQL                       StateIrql;
+    BOOLEAN                     StateBlocking;
+    KEVENT                      StateIdle;
+    LONG                        StateEpoch;
 
     XENVBD_CAPS                 Caps;
     XENVBD_FEATURES             Features;
     XENVBD_DISKINFO             DiskInfo;
     PVOID                       Inquiry;
 
+    // Backend Snapshot - key names under BackendPath, held across a batch
+    // of reads so keys the backend never wrote are not read
+    PCHAR                       BackendKeys;
+    ULONG                       SnapshotReads;
+    ULONG                       SnapshotSkips;
+
     // Interfaces to XenBus
     PXENBUS_STORE_INTERFACE     Store;
     PXENBUS_SUSPEND_INTERFACE   Suspend;
@@ -74,14 +86,19 @@ struct _XENVBD_FRONTEND {
     PXENVBD_BLOCKRING           BlockRing;
     PXENVBD_GRANTER             Granter;
 
-    // Backend State Watch
+    // Backend State Watch, signalled only by this target's backend and
+    // polled by the FDO's frontend thread
     BOOLEAN                     Active;
-    PKEVENT                     BackendEvent;
-    PXENBUS_STORE_WATCH         BackendWatch;
+    KEVENT                      DirtyEvent;
+    PXENBUS_STORE_WATCH         DirtyWatch;
+    ULONG                       BackendChanges;
 };
 
 #define DOMID_INVALID (0x7FF4U)
 
+#define FRONTEND_WAIT_TIMEOUT   TIME_RELATIVE(TIME_S(1LL))
+#define FRONTEND_WAIT_WARNING   TIME_S(10LL)
+
 static const PCHAR
 __XenvbdStateName(
     IN  XENVBD_STATE                        State
@@ -178,6 +195,20 @@ FrontendGetTargetId(
 {
     return Frontend->TargetId;
 }
+PXENVBD_NUMA_PLACEMENT
+FrontendGetPlacement(
+    __in  PXENVBD_FRONTEND      Frontend
+    )
+{
+    return &Frontend->Placement;
+}
+USHORT
+FrontendGetBackendDomain(
+    __in  PXENVBD_FRONTEND      Frontend
+    )
+{
+    return Frontend->BackendId;
+}
 PVOID
 FrontendGetInquiry(
     __in  PXENVBD_FRONTEND      Frontend
@@ -229,6 +260,82 @@ FrontendStoreWriteFrontend(
                         Value);
 }
 NTSTATUS
+FrontendStoreReadFrontend(
+    __in  PXENVBD_FRONTEND      Frontend,
+    __in  PCHAR                 Name,
+    __out PCHAR*                Value
+    )
+{
+    if (Frontend->Store == NULL)
+        return STATUS_INVALID_PARAMETER;
+
+    return XENBUS_STORE(Read,
+                        Frontend->Store,
+                        NULL,
+                        Frontend->FrontendPath,
+                        Name,
+                        Value);
+}
+__drv_requiresIRQL(DISPATCH_LEVEL)
+static VOID
+__FrontendSnapshotBackend(
+    __in  PXENVBD_FRONTEND      Frontend
+    )
+{
+    NTSTATUS    Status;
+
+    ASSERT3P(Frontend->BackendKeys, ==, NULL);
+
+    Status = XENBUS_STORE(Directory,
+                          Frontend->Store,
+                          NULL,
+                          NULL,
+                          Frontend->BackendPath,
+                          &Frontend->BackendKeys);
+    if (!NT_SUCCESS(Status))
+        Frontend->BackendKeys = NULL;   // read every key
+}
+__drv_requiresIRQL(DISPATCH_LEVEL)
+static VOID
+__FrontendReleaseSnapshot(
+    __in  PXENVBD_FRONTEND      Frontend
+    )
+{
+    if (Frontend->BackendKeys == NULL)
+        return;
+
+    XENBUS_STORE(Free,
+                 Frontend->Store,
+                 Frontend->BackendKeys);
+    Frontend->BackendKeys = NULL;
+}
+static BOOLEAN
+__FrontendBackendHasKey(
+    __in  PXENVBD_FRONTEND      Frontend,
+    __in  PCHAR                 Name
+    )
+{
+    PCHAR       Key;
+    ULONG       Length;
+
+    if (Frontend->BackendKeys == NULL)
+        return TRUE;
+
+    // the snapshot only holds the first component of nested names
+    for (Length = 0; Name[Length] != '\0' && Name[Length] != '/'; ++Length)
+        ;
+
+    for (Key = Frontend->BackendKeys; *Key != '\0'; Key += strlen(Key) + 1) {
+        if (strlen(Key) == Length && strncmp(Key, Name, Length) == 0) {
+            ++Frontend->SnapshotReads;
+            return TRUE;
+        }
+    }
+
+    ++Frontend->SnapshotSkips;
+    return FALSE;
+}
+NTSTATUS
 FrontendStoreReadBackend(
     __in  PXENVBD_FRONTEND      Frontend,
     __in  PCHAR                 Name,
@@ -244,6 +351,10 @@ FrontendStoreReadBackend(
     if (Frontend->BackendPath == NULL)
         goto fail2;
 
+    Status = STATUS_OBJECT_NAME_NOT_FOUND;
+    if (!__FrontendBackendHasKey(Frontend, Name))
+        goto fail3;
+
     Status = XENBUS_STORE(Read,
                           Frontend->Store,
                           NULL,
@@ -251,10 +362,11 @@ FrontendStoreReadBackend(
                           Name,
                           Value);
     if (!NT_SUCCESS(Status))
-        goto fail3;
+        goto fail4;
 
     return STATUS_SUCCESS;
 
+fail4:
 fail3:
 fail2:
 fail1:
@@ -317,6 +429,41 @@ out:
     return Status;
 }
 
+__drv_maxIRQL(DISPATCH_LEVEL)
+NTSTATUS
+FrontendWriteStats(
+    __in  PXENVBD_FRONTEND        Frontend,
+    __in  PCHAR                   Name,
+    __in  PCHAR                   Record
+    )
+{
+    NTSTATUS    Status;
+    KIRQL       Irql;
+
+    // D0->D3 releases Store under StateLock, so hold it across the write.
+    // Skip a target mid-transition, the next interval publishes again
+    KeAcquireSpinLock(&Frontend->StateLock, &Irql);
+
+    Status = STATUS_DEVICE_NOT_READY;
+    if (!Frontend->Active ||
+        Frontend->StateBlocking ||
+        Frontend->Store == NULL ||
+        !Frontend->Caps.Connected)
+        goto done;
+
+    Status = XENBUS_STORE(Printf,
+                          Frontend->Store,
+                          NULL,
+                          Frontend->FrontendPath,
+                          Name,
+                          "%s",
+                          Record);
+
+done:
+    KeReleaseSpinLock(&Frontend->StateLock, Irql);
+    return Status;
+}
+
 //=============================================================================
 __drv_requiresIRQL(DISPATCH_LEVEL)
 VOID
@@ -433,9 +580,17 @@ __WaitState(
     LARGE_INTEGER   StartTime;
     LARGE_INTEGER   CurrentTime;
     ULONG           Count = 0;
+    const LONG      Epoch = Frontend->StateEpoch;
 
     KeInitializeEvent(&Event, NotificationEvent, FALSE);
-    Timeout.QuadPart = 0;
+
+    // A transition requested below DISPATCH_LEVEL gives up the state lock
+    // and sleeps until the watch fires. Otherwise (reset, suspend callback)
+    // nothing else can deliver the watch, so poll the store.
+    if (Frontend->StateBlocking)
+        Timeout.QuadPart = FRONTEND_WAIT_TIMEOUT;
+    else
+        Timeout.QuadPart = 0;
 
     ASSERT3P(Frontend->BackendPath, !=, NULL);
     Status = XENBUS_STORE(WatchAdd,
@@ -450,27 +605,49 @@ __WaitState(
     KeQuerySystemTime(&StartTime);
 
     while (OldState == *State) {
-        // check event and spin or read
+        NTSTATUS    WaitStatus;
+
+        if (Frontend->StateBlocking) {
+            KeReleaseSpinLock(&Frontend->StateLock, Frontend->StateIrql);
+
+            WaitStatus = KeWaitForSingleObject(&Event, Executive, KernelMode,
+                                               FALSE, &Timeout);
+
+            KeAcquireSpinLock(&Frontend->StateLock, &Frontend->StateIrql);
+
+            // the frontend was torn down and restored by a resume while
+            // the lock was dropped, so this transition is stale
+            Status = STATUS_RETRY;
+            if (Frontend->StateEpoch != Epoch)
+                goto fail2;
+        } else {
 #pragma prefast(suppress:28121)
-        if (KeWaitForSingleObject(&Event, Executive, KernelMode, 
-                                    FALSE, &Timeout) == STATUS_TIMEOUT) {
-            XENBUS_STORE(Poll,
-                         Frontend->Store);
+            WaitStatus = KeWaitForSingleObject(&Event, Executive, KernelMode, 
+                                               FALSE, &Timeout);
+            if (WaitStatus == STATUS_TIMEOUT)
+                XENBUS_STORE(Poll,
+                             Frontend->Store);
+        }
 
+        if (WaitStatus == STATUS_TIMEOUT) {
             KeQuerySystemTime(&CurrentTime);
-            if ((CurrentTime.QuadPart - StartTime.QuadPart) > 10000) {
-                Warning("Target[%d] : %d Waited for %d ms\n", Frontend->TargetId, 
-                            Count, (ULONG)((CurrentTime.QuadPart - StartTime.QuadPart) / 10));
-                StartTime.QuadPart = CurrentTime.QuadPart;
+            if ((CurrentTime.QuadPart - StartTime.QuadPart) > FRONTEND_WAIT_WARNING) {
                 ++Count;
+                Warning("Target[%d] : Waited for %d s for backend to leave %s\n",
+                        Frontend->TargetId,
+                        Count * 10,
+                        XenbusStateName(OldState));
+                StartTime.QuadPart = CurrentTime.QuadPart;
             }
 
             continue;
         }
 
+        KeClearEvent(&Event);
+
         Status = __ReadState(Frontend, NULL, Frontend->BackendPath, State);
         if (!NT_SUCCESS(Status))
-            goto fail2;
+            goto fail3;
     }
 
     XENBUS_STORE(WatchRemove,
@@ -483,6 +660,8 @@ __WaitState(
 
     return STATUS_SUCCESS;
 
+fail3:
+    Error("Fail3\n");
 fail2:
     Error("Fail2\n");
 
@@ -621,6 +800,9 @@ FrontendReadFeature(
     PCHAR           Buffer;
     BOOLEAN         Old = *Value;
 
+    if (!__FrontendBackendHasKey(Frontend, Name))
+        return FALSE;   // no value, unchanged
+
     status = XENBUS_STORE(Read,
                           Frontend->Store,
                           NULL,
@@ -649,6 +831,9 @@ FrontendReadValue32(
     PCHAR           Buffer;
     ULONG           Old = *Value;
 
+    if (!__FrontendBackendHasKey(Frontend, Name))
+        return FALSE;   // no value, unchanged
+
     status = XENBUS_STORE(Read,
                           Frontend->Store,
                           NULL,
@@ -677,6 +862,9 @@ FrontendReadValue64(
     PCHAR           Buffer;
     ULONG64         Old = *Value;
 
+    if (!__FrontendBackendHasKey(Frontend, Name))
+        return FALSE;   // no value, unchanged
+
     status = XENBUS_STORE(Read,
                           Frontend->Store,
                           NULL,
@@ -852,11 +1040,11 @@ FrontendClose(
     XenbusState     BackendState;
 
     // unwatch backend (null check for initial close operation)
-    if (Frontend->BackendWatch)
+    if (Frontend->DirtyWatch)
         XENBUS_STORE(WatchRemove,
                      Frontend->Store,
-                     Frontend->BackendWatch);
-    Frontend->BackendWatch = NULL;
+                     Frontend->DirtyWatch);
+    Frontend->DirtyWatch = NULL;
     
     Frontend->BackendId = DOMID_INVALID;
 
@@ -920,13 +1108,14 @@ FrontendPrepare(
     if (!NT_SUCCESS(Status))
         goto fail1;
 
-    // watch backend (4 paths needed)
+    // watch backend (4 paths needed), on an event of this target's own so
+    // a change to it can be told apart from a change to any other target
     Status = XENBUS_STORE(WatchAdd,
                           Frontend->Store,
                           NULL,
                           Frontend->BackendPath,
-                          Frontend->BackendEvent,
-                          &Frontend->BackendWatch);
+                          &Frontend->DirtyEvent,
+                          &Frontend->DirtyWatch);
     if (!NT_SUCCESS(Status))
         goto fail2;
 
@@ -972,6 +1161,8 @@ FrontendPrepare(
     if (BackendState != XenbusStateInitWait)
         goto fail8;
 
+    __FrontendSnapshotBackend(Frontend);
+
     // read inquiry data
     if (Frontend->Inquiry == NULL)
         PdoReadInquiryData(Frontend, &Frontend->Inquiry);
@@ -984,6 +1175,8 @@ FrontendPrepare(
             Frontend->BackendPath);
 
     FrontendReadFeatures(Frontend);
+
+    __FrontendReleaseSnapshot(Frontend);
     
     return STATUS_SUCCESS;
 
@@ -1001,8 +1194,8 @@ fail3:
     Error("Fail3\n");
     (VOID) XENBUS_STORE(WatchRemove,
                         Frontend->Store,
-                        Frontend->BackendWatch);
-    Frontend->BackendWatch = NULL;
+                        Frontend->DirtyWatch);
+    Frontend->DirtyWatch = NULL;
 fail2:
     Error("Fail2\n");
 fail1:
@@ -1125,6 +1318,8 @@ abort:
     if (!NT_SUCCESS(Status))
         goto fail8;
 
+    __FrontendSnapshotBackend(Frontend);
+
     // read disk info
     __ReadDiskInfo(Frontend);
     FrontendReadDiskInfo(Frontend);
@@ -1132,6 +1327,8 @@ abort:
     // blkback doesnt write features before InitWait, blkback writes features before Connected!
     FrontendReadFeatures(Frontend);
 
+    __FrontendReleaseSnapshot(Frontend);
+
     return STATUS_SUCCESS;
 
 fail8:
@@ -1175,6 +1372,8 @@ FrontendEnable(
     KeMemoryBarrier();
 
     GranterEnable(Frontend->Granter);
+    // requests kept across a resume need grants before the ring can take them
+    PdoResumeRequests(Frontend->Pdo);
     BlockRingEnable(Frontend->BlockRing);
     NotifierEnable(Frontend->Notifier);
 }
@@ -1250,7 +1449,7 @@ __FrontendSetState(
                     Status = FrontendClose(Frontend);
                     if (NT_SUCCESS(Status))
                         Frontend->State = XENVBD_CLOSED;
-                    else
+                    else if (Status != STATUS_RETRY)
                         Frontend->State = XENVBD_STATE_INVALID;
                     Failed = TRUE;
                 }
@@ -1272,7 +1471,7 @@ __FrontendSetState(
                     Status = FrontendClose(Frontend);
                     if (NT_SUCCESS(Status))
                         Frontend->State = XENVBD_CLOSED;
-                    else
+                    else if (Status != STATUS_RETRY)
                         Frontend->State = XENVBD_STATE_INVALID;
                     Failed = TRUE;
                 }
@@ -1283,7 +1482,8 @@ __FrontendSetState(
                 if (NT_SUCCESS(Status)) {
                     Frontend->State = XENVBD_CLOSED;
                 } else {
-                    Frontend->State = XENVBD_STATE_INVALID;
+                    if (Status != STATUS_RETRY)
+                        Frontend->State = XENVBD_STATE_INVALID;
                     Failed = TRUE;
                 }
                 break;
@@ -1303,6 +1503,10 @@ __FrontendSetState(
             case XENVBD_CLOSED:
             case XENVBD_PREPARED:
                 Status = FrontendClose(Frontend);
+                if (Status == STATUS_RETRY) {
+                    Failed = TRUE;
+                    break;
+                }
                 Frontend->State = XENVBD_CLOSING;
                 break;
             default:
@@ -1358,33 +1562,47 @@ FrontendSuspendLateCallback(
     __in  PVOID                   Argument
     )
 {
-    NTSTATUS            Status;
     XENVBD_STATE        State;
     PXENVBD_FRONTEND    Frontend = (PXENVBD_FRONTEND)Argument;
 
     Verbose("Target[%d] : ===> from %s\n", Frontend->TargetId, __XenvbdStateName(Frontend->State));
     State = Frontend->State;
 
+    // keep outstanding requests, only their grants go with the old backend
     PdoPreResume(Frontend->Pdo);
 
-    // dont acquire state lock - called at DISPATCH on 1 vCPU with interrupts enabled
-    Status = __FrontendSetState(Frontend, XENVBD_CLOSED);
-    if (!NT_SUCCESS(Status)) {
-        Error("Target[%d] : SetState CLOSED (%08x)\n", Frontend->TargetId, Status);
-        ASSERT(FALSE);
-    }
+    // A transition may be sleeping in __WaitState with the state lock
+    // dropped. Bump the epoch so it unwinds and starts again when it wakes,
+    // and leave the reconnect to it.
+    ++Frontend->StateEpoch;
 
+    // Only tear down what is local here. The handshake with the new backend
+    // is left to FrontendResume, called for every target in parallel once
+    // all vCPUs are running again, rather than polled here one at a time.
     // dont acquire state lock - called at DISPATCH on 1 vCPU with interrupts enabled
-    Status = __FrontendSetState(Frontend, State);
-    if (!NT_SUCCESS(Status)) {
-        Error("Target[%d] : SetState %s (%08x)\n", Frontend->TargetId, __XenvbdStateName(State), Status);
-        ASSERT(FALSE);
+    switch (State) {
+    case XENVBD_ENABLED:
+        FrontendDisable(Frontend);
+        // fall through
+    case XENVBD_CONNECTED:
+    case XENVBD_CLOSING:
+        FrontendDisconnect(Frontend);
+        break;
+    default:
+        break;
     }
 
+    // backend state unknown, so the next transition starts with a close
+    Frontend->State = XENVBD_INITIALIZED;
+    // a second suspend before the resume thread has run finds the state
+    // already torn down, so keep the state recorded by the first one
+    if (!Frontend->StateBlocking &&
+        Frontend->ResumeState == XENVBD_STATE_INVALID)
+        Frontend->ResumeState = State;
+
     PdoPostResume(Frontend->Pdo);
-    NotifierTrigger(Frontend->Notifier);
 
-    Verbose("Target[%d] : <=== restored %s\n", Frontend->TargetId, __XenvbdStateName(Frontend->State));
+    Verbose("Target[%d] : <=== resume to %s pending\n", Frontend->TargetId, __XenvbdStateName(State));
 }
 
 __checkReturn
@@ -1484,39 +1702,128 @@ FrontendD0ToD3(
     KeReleaseSpinLock(&Frontend->StateLock, Irql);
 }
 
+static NTSTATUS
+__FrontendRequestState(
+    __in  PXENVBD_FRONTEND        Frontend,
+    __in  XENVBD_STATE            State,
+    __in  BOOLEAN                 Resume
+    )
+{
+    NTSTATUS    Status;
+    KIRQL       Irql;
+    LONG        Epoch;
+
+    KeAcquireSpinLock(&Frontend->StateLock, &Irql);
+
+    // another transition is waiting on its backend with the lock dropped
+    while (Frontend->StateBlocking) {
+        KeReleaseSpinLock(&Frontend->StateLock, Irql);
+
+        Status = STATUS_DEVICE_BUSY;
+        if (Irql == DISPATCH_LEVEL)
+            goto fail1;
+
+        (VOID) KeWaitForSingleObject(&Frontend->StateIdle, Executive,
+                                     KernelMode, FALSE, NULL);
+
+        KeAcquireSpinLock(&Frontend->StateLock, &Irql);
+    }
+
+    // any other request replaces a resume that has not run yet
+    if (Resume)
+        State = Frontend->ResumeState;
+    Frontend->ResumeState = XENVBD_STATE_INVALID;
+
+    Status = STATUS_SUCCESS;
+    if (State == XENVBD_STATE_INVALID)
+        goto done;
+
+    // below DISPATCH_LEVEL the backend handshakes can sleep rather than
+    // spin, which lets every target negotiate at the same time
+    if (Irql < DISPATCH_LEVEL) {
+        Frontend->StateBlocking = TRUE;
+        Frontend->StateIrql = Irql;
+        KeClearEvent(&Frontend->StateIdle);
+    }
+
+    do {
+        Epoch = Frontend->StateEpoch;
+        Status = __FrontendSetState(Frontend, State);
+    } while (!NT_SUCCESS(Status) && Frontend->StateEpoch != Epoch);
+
+    if (Frontend->StateBlocking) {
+        Frontend->StateBlocking = FALSE;
+        KeSetEvent(&Frontend->StateIdle, IO_NO_INCREMENT, FALSE);
+    }
+
+done:
+    KeReleaseSpinLock(&Frontend->StateLock, Irql);
+    return Status;
+
+fail1:
+    Warning("Target[%d] : transition to %s in progress\n",
+            Frontend->TargetId,
+            __XenvbdStateName(State));
+    return Status;
+}
+
 __checkReturn
+__drv_maxIRQL(DISPATCH_LEVEL)
 NTSTATUS
 FrontendSetState(
     __in  PXENVBD_FRONTEND        Frontend,
     __in  XENVBD_STATE            State
     )
+{
+    return __FrontendRequestState(Frontend, State, FALSE);
+}
+
+__checkReturn
+__drv_maxIRQL(PASSIVE_LEVEL)
+NTSTATUS
+FrontendResume(
+    __in  PXENVBD_FRONTEND        Frontend
+    )
 {
     NTSTATUS    Status;
-    KIRQL       Irql;
 
-    KeAcquireSpinLock(&Frontend->StateLock, &Irql);
+    Status = __FrontendRequestState(Frontend, XENVBD_STATE_INVALID, TRUE);
+    if (!NT_SUCCESS(Status))
+        Error("Target[%d] : resume failed (%08x)\n", Frontend->TargetId, Status);
 
-    Status = __FrontendSetState(Frontend, State);
+    NotifierTrigger(Frontend->Notifier);
 
-    KeReleaseSpinLock(&Frontend->StateLock, Irql);
     return Status;
 }
 
-__drv_requiresIRQL(DISPATCH_LEVEL)
-VOID
+__drv_maxIRQL(DISPATCH_LEVEL)
+BOOLEAN
 FrontendBackendPathChanged(
     __in  PXENVBD_FRONTEND        Frontend
     )
 {
     KIRQL       Irql;
+
+    // All targets share the thread that polls this, so most calls are for
+    // another target's backend. Only re-read if this target's watch fired.
+    if (!KeReadStateEvent(&Frontend->DirtyEvent))
+        return FALSE;
+
     KeAcquireSpinLock(&Frontend->StateLock, &Irql);
     // Only attempt this if Active, Active is set/cleared on D3->D0/D0->D3
-    if (Frontend->Active) {
-        // Note: Nothing may have changed with this target, this could be caused by another target changing
+    // Skip it while a transition is sleeping with the state lock dropped,
+    // the target stays dirty and the next poll picks it up
+    if (Frontend->Active && !Frontend->StateBlocking) {
+        // clear first, so a change made while reading marks it dirty again
+        KeClearEvent(&Frontend->DirtyEvent);
+        ++Frontend->BackendChanges;
+
         __ReadDiskInfo(Frontend);
         __CheckBackendForEject(Frontend);
     }
     KeReleaseSpinLock(&Frontend->StateLock, Irql);
+
+    return TRUE;
 }
 
 __checkReturn
@@ -1525,7 +1832,6 @@ FrontendCreate(
     __in  PXENVBD_PDO             Pdo,
     __in  PCHAR                   DeviceId, 
     __in  ULONG                   TargetId, 
-    __in  PKEVENT                 Event,
     __out PXENVBD_FRONTEND*       _Frontend
     )
 {
@@ -1545,9 +1851,10 @@ FrontendCreate(
     Frontend->TargetId = TargetId;
     Frontend->DeviceId = strtoul(DeviceId, NULL, 10);
     Frontend->State = XENVBD_INITIALIZED;
+    Frontend->ResumeState = XENVBD_STATE_INVALID;
     Frontend->DiskInfo.SectorSize = 512; // default sector size
     Frontend->BackendId = DOMID_INVALID;
-    Frontend->BackendEvent = Event;
+    NumaPlaceTarget(TargetId, &Frontend->Placement);
     
     Status = STATUS_INSUFFICIENT_RESOURCES;
     Frontend->FrontendPath = DriverFormat("device/%s/%s", FdoEnum(PdoGetFdo(Pdo)), DeviceId);
@@ -1572,6 +1879,8 @@ FrontendCreate(
 
     // kernel objects
     KeInitializeSpinLock(&Frontend->StateLock);
+    KeInitializeEvent(&Frontend->StateIdle, NotificationEvent, TRUE);
+    KeInitializeEvent(&Frontend->DirtyEvent, NotificationEvent, FALSE);
     
     Trace("Target[%d] @ (%d) <===== (STATUS_SUCCESS)\n", Frontend->TargetId, KeGetCurrentIrql());
     *_Frontend = Frontend;
@@ -1632,7 +1941,8 @@ FrontendDestroy(
     ASSERT3P(Frontend->BackendPath, ==, NULL);
     ASSERT3P(Frontend->Inquiry, ==, NULL);
     ASSERT3P(Frontend->SuspendLateCallback, ==, NULL);
-    ASSERT3P(Frontend->BackendWatch, ==, NULL);
+    ASSERT3P(Frontend->DirtyWatch, ==, NULL);
+    ASSERT3P(Frontend->BackendKeys, ==, NULL);
 
     __FrontendFree(Frontend);
     Trace("Target[%d] @ (%d) <=====\n", TargetId, KeGetCurrentIrql());
@@ -1660,9 +1970,25 @@ FrontendDebugCallback(
     XENBUS_DEBUG(Printf, Debug,
                  "FRONTEND: TargetPath   %s\n",
                  Frontend->TargetPath);
+    if (Frontend->Placement.Bound)
+        XENBUS_DEBUG(Printf, Debug,
+                     "FRONTEND: Placement : Node %u CPU %u:%u\n",
+                     Frontend->Placement.Node,
+                     Frontend->Placement.Group,
+                     Frontend->Placement.Number);
+    XENBUS_DEBUG(Printf, Debug,
+                 "FRONTEND: BackendChanges %u%s\n",
+                 Frontend->BackendChanges,
+                 KeReadStateEvent(&Frontend->DirtyEvent) ? " (DIRTY)" : "");
+    XENBUS_DEBUG(Printf, Debug,
+                 "FRONTEND: Snapshot: %u reads, %u skipped\n",
+                 Frontend->SnapshotReads,
+                 Frontend->SnapshotSkips);
     XENBUS_DEBUG(Printf, Debug,
-                 "FRONTEND: State   : %s\n",
-                 __XenvbdStateName(Frontend->State));
+                 "FRONTEND: State   : %s%s (Epoch %d)\n",
+                 __XenvbdStateName(Frontend->State),
+                 Frontend->StateBlocking ? " BLOCKING" : "",
+                 Frontend->StateEpoch);
 
     XENBUS_DEBUG(Printf, Debug,
                  "FRONTEND: Caps    : %s%s%s%s%s%s\n",
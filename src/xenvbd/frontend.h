@@ -96,6 +96,15 @@ extern ULONG
 FrontendGetTargetId(
     __in  PXENVBD_FRONTEND      Frontend
     );
+#include "numa.h"
+extern PXENVBD_NUMA_PLACEMENT
+FrontendGetPlacement(
+    __in  PXENVBD_FRONTEND      Frontend
+    );
+extern USHORT
+FrontendGetBackendDomain(
+    __in  PXENVBD_FRONTEND      Frontend
+    );
 extern PVOID
 FrontendGetInquiry(
     __in  PXENVBD_FRONTEND      Frontend
@@ -127,6 +136,12 @@ FrontendStoreWriteFrontend(
     __in  PCHAR                 Value
     );
 extern NTSTATUS
+FrontendStoreReadFrontend(
+    __in  PXENVBD_FRONTEND      Frontend,
+    __in  PCHAR                 Name,
+    __out PCHAR*                Value
+    );
+extern NTSTATUS
 FrontendStoreReadBackend(
     __in  PXENVBD_FRONTEND      Frontend,
     __in  PCHAR                 Name,
@@ -143,6 +158,14 @@ FrontendWriteUsage(
     __in  PXENVBD_FRONTEND        Frontend
     );
 
+__drv_maxIRQL(DISPATCH_LEVEL)
+extern NTSTATUS
+FrontendWriteStats(
+    __in  PXENVBD_FRONTEND        Frontend,
+    __in  PCHAR                   Name,
+    __in  PCHAR                   Record
+    );
+
 // Ring
 __drv_requiresIRQL(DISPATCH_LEVEL)
 extern VOID
@@ -165,14 +188,23 @@ FrontendD0ToD3(
     );
 
 __checkReturn
+__drv_maxIRQL(DISPATCH_LEVEL)
 extern NTSTATUS
 FrontendSetState(
     __in  PXENVBD_FRONTEND        Frontend,
     __in  XENVBD_STATE            State
     );
 
-__drv_requiresIRQL(DISPATCH_LEVEL)
-extern VOID
+__checkReturn
+__drv_maxIRQL(PASSIVE_LEVEL)
+extern NTSTATUS
+FrontendResume(
+    __in  PXENVBD_FRONTEND        Frontend
+    );
+
+// Re-reads the backend if its watch has fired, returns TRUE if it had
+__drv_maxIRQL(DISPATCH_LEVEL)
+extern BOOLEAN
 FrontendBackendPathChanged(
     __in  PXENVBD_FRONTEND        Frontend
     );
@@ -183,7 +215,6 @@ FrontendCreate(
     __in  PXENVBD_PDO             Pdo,
     __in  PCHAR                   DeviceId, 
     __in  ULONG                   TargetId, 
-    __in  PKEVENT                 Event,
     __out PXENVBD_FRONTEND*       _Frontend
     );
 
@@ -256,7 +256,6 @@ GranterDebugCallback(
                  "GRANTER: %d / %d\n",
                  Granter->Current,
                  Granter->Maximum);
-    Granter->Maximum = Granter->Current;
 }
 
 NTSTATUS
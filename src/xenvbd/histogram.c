@@ -0,0 +1,205 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, 
+ * with or without modification, are permitted provided 
+ * that the following conditions are met:
+ * 
+ * *   Redistributions of source code must retain the above 
+ *     copyright notice, this list of conditions and the 
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above 
+ *     copyright notice, this list of conditions and the 
+ *     following disclaimer in the documentation and/or other 
+ *     materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND 
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF 
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR 
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF 
+ * SUCH DAMAGE.
+ */ 
+
+#include "histogram.h"
+#include "debug.h"
+#include "assert.h"
+
+static LONG64   __HistogramFrequency;
+
+ULONG64
+HistogramNow(
+    VOID
+    )
+{
+    LARGE_INTEGER   Frequency;
+    LARGE_INTEGER   Counter;
+
+    Counter = KeQueryPerformanceCounter(&Frequency);
+    if (__HistogramFrequency == 0)
+        __HistogramFrequency = Frequency.QuadPart;
+
+    return (ULONG64)Counter.QuadPart;
+}
+
+ULONG64
+HistogramTicksToUs(
+    __in ULONG64                Ticks
+    )
+{
+    const ULONG64   Frequency = (ULONG64)__HistogramFrequency;
+
+    if (Frequency == 0)
+        return 0;
+
+    // split so absolute counter values (timestamps in the trace and outlier
+    // records) do not overflow the multiply once the system has been up a
+    // few weeks
+    return (Ticks / Frequency) * 1000000ull +
+           ((Ticks % Frequency) * 1000000ull) / Frequency;
+}
+
+static FORCEINLINE ULONG
+__HistogramBucket(
+    __in ULONG64                Value
+    )
+{
+    ULONG   Bucket = 0;
+
+    while (Value != 0 && Bucket < XENVBD_HISTOGRAM_BUCKETS - 1) {
+        Value >>= 1;
+        ++Bucket;
+    }
+
+    return Bucket;
+}
+
+VOID
+HistogramAdd(
+    __in PXENVBD_HISTOGRAM      Histogram,
+    __in ULONG64                Value
+    )
+{
+    LONG64  Maximum;
+
+    InterlockedIncrement64(&Histogram->Buckets[__HistogramBucket(Value)]);
+    InterlockedIncrement64(&Histogram->Count);
+    InterlockedExchangeAdd64(&Histogram->Total, (LONG64)Value);
+
+    do {
+        Maximum = Histogram->Maximum;
+        if ((LONG64)Value <= Maximum)
+            break;
+    } while (InterlockedCompareExchange64(&Histogram->Maximum,
+                                          (LONG64)Value,
+                                          Maximum) != Maximum);
+}
+
+VOID
+HistogramMerge(
+    __inout PXENVBD_HISTOGRAM   Histogram,
+    __in PXENVBD_HISTOGRAM      Source
+    )
+{
+    ULONG   Bucket;
+
+    for (Bucket = 0; Bucket < XENVBD_HISTOGRAM_BUCKETS; ++Bucket)
+        Histogram->Buckets[Bucket] += Source->Buckets[Bucket];
+
+    Histogram->Count += Source->Count;
+    Histogram->Total += Source->Total;
+    if (Source->Maximum > Histogram->Maximum)
+        Histogram->Maximum = Source->Maximum;
+}
+
+VOID
+HistogramDelta(
+    __out PXENVBD_HISTOGRAM     Result,
+    __in PXENVBD_HISTOGRAM      Current,
+    __in PXENVBD_HISTOGRAM      Previous
+    )
+{
+    ULONG   Bucket;
+
+    Result->Count = 0;
+    for (Bucket = 0; Bucket < XENVBD_HISTOGRAM_BUCKETS; ++Bucket) {
+        LONG64  Delta = Current->Buckets[Bucket] - Previous->Buckets[Bucket];
+
+        Result->Buckets[Bucket] = (Delta > 0) ? Delta : 0;
+        Result->Count += Result->Buckets[Bucket];
+    }
+
+    Result->Total = Current->Total - Previous->Total;
+    Result->Maximum = Current->Maximum;
+}
+
+ULONG64
+HistogramPercentile(
+    __in PXENVBD_HISTOGRAM      Histogram,
+    __in ULONG                  Percent
+    )
+{
+    LONG64  Count = Histogram->Count;
+    LONG64  Target;
+    LONG64  Sum = 0;
+    ULONG   Bucket;
+
+    ASSERT3U(Percent, <=, 100);
+
+    if (Count == 0)
+        return 0;
+
+    // upper bound of the bucket holding the requested rank
+    Target = (Count * Percent + 99) / 100;
+    for (Bucket = 0; Bucket < XENVBD_HISTOGRAM_BUCKETS; ++Bucket) {
+        Sum += Histogram->Buckets[Bucket];
+        if (Sum >= Target)
+            break;
+    }
+
+    if (Bucket >= XENVBD_HISTOGRAM_BUCKETS - 1)
+        return (ULONG64)Histogram->Maximum;
+
+    return 1ull << Bucket;
+}
+
+VOID
+HistogramDebugCallback(
+    __in PXENVBD_HISTOGRAM              Histogram,
+    __in __nullterminated const CHAR*   Name,
+    __in PXENBUS_DEBUG_INTERFACE        Debug
+    )
+{
+    ULONG   Bucket;
+
+    if (Histogram->Count == 0)
+        return;
+
+    XENBUS_DEBUG(Printf, Debug,
+                 "HISTOGRAM: %s : %lld (avg %lldus max %lldus p50 %lluus p99 %lluus)\n",
+                 Name,
+                 Histogram->Count,
+                 Histogram->Total / Histogram->Count,
+                 Histogram->Maximum,
+                 HistogramPercentile(Histogram, 50),
+                 HistogramPercentile(Histogram, 99));
+
+    for (Bucket = 0; Bucket < XENVBD_HISTOGRAM_BUCKETS; ++Bucket) {
+        if (Histogram->Buckets[Bucket] == 0)
+            continue;
+
+        XENBUS_DEBUG(Printf, Debug,
+                     "HISTOGRAM: %s : <%8lluus : %lld\n",
+                     Name,
+                     1ull << Bucket,
+                     Histogram->Buckets[Bucket]);
+    }
+}
@@ -0,0 +1,95 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, 
+ * with or without modification, are permitted provided 
+ * that the following conditions are met:
+ * 
+ * *   Redistributions of source code must retain the above 
+ *     copyright notice, this list of conditions and the 
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above 
+ *     copyright notice, this list of conditions and the 
+ *     following disclaimer in the documentation and/or other 
+ *     materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND 
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF 
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR 
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF 
+ * SUCH DAMAGE.
+ */ 
+
+#ifndef _XENVBD_HISTOGRAM_H
+#define _XENVBD_HISTOGRAM_H
+
+#include <ntddk.h>
+#include <debug_interface.h>
+
+// Bucket 0 counts values of 0us, bucket N (N > 0) counts values in
+// [2^(N-1), 2^N)us. The last bucket also takes everything larger (> ~4s)
+#define XENVBD_HISTOGRAM_BUCKETS    24
+
+typedef struct _XENVBD_HISTOGRAM {
+    LONG64              Buckets[XENVBD_HISTOGRAM_BUCKETS];
+    LONG64              Count;
+    LONG64              Total;
+    LONG64              Maximum;
+} XENVBD_HISTOGRAM, *PXENVBD_HISTOGRAM;
+
+extern ULONG64
+HistogramNow(
+    VOID
+    );
+
+extern ULONG64
+HistogramTicksToUs(
+    __in ULONG64                Ticks
+    );
+
+extern VOID
+HistogramAdd(
+    __in PXENVBD_HISTOGRAM      Histogram,
+    __in ULONG64                Value
+    );
+
+// Accumulates Source into Histogram. Not atomic with respect to HistogramAdd
+// on Source, so the result is a snapshot
+extern VOID
+HistogramMerge(
+    __inout PXENVBD_HISTOGRAM   Histogram,
+    __in PXENVBD_HISTOGRAM      Source
+    );
+
+// Result = Current - Previous, for the values added between two snapshots.
+// Maximum is taken from Current
+extern VOID
+HistogramDelta(
+    __out PXENVBD_HISTOGRAM     Result,
+    __in PXENVBD_HISTOGRAM      Current,
+    __in PXENVBD_HISTOGRAM      Previous
+    );
+
+extern ULONG64
+HistogramPercentile(
+    __in PXENVBD_HISTOGRAM      Histogram,
+    __in ULONG                  Percent
+    );
+
+extern VOID
+HistogramDebugCallback(
+    __in PXENVBD_HISTOGRAM              Histogram,
+    __in __nullterminated const CHAR*   Name,
+    __in PXENBUS_DEBUG_INTERFACE        Debug
+    );
+
+#endif // _XENVBD_HISTOGRAM_H
@@ -0,0 +1,66 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, 
+ * with or without modification, are permitted provided 
+ * that the following conditions are met:
+ * 
+ * *   Redistributions of source code must retain the above 
+ *     copyright notice, this list of conditions and the 
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above 
+ *     copyright notice, this list of conditions and the 
+ *     following disclaimer in the documentation and/or other 
+ *     materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND 
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF 
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR 
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF 
+ * SUCH DAMAGE.
+ */ 
+
+#ifndef _XENVBD_IOTRACE_H
+#define _XENVBD_IOTRACE_H
+
+#include <ntddk.h>
+#include <xenvbd-storport.h>
+
+// Each target keeps the last XENVBD_IOTRACE_RECORDS completed data path
+// SRBs. Records are written without a lock, so a record being overwritten
+// while it is read may be torn
+
+#define XENVBD_IOTRACE_RECORDS      256     // power of 2
+
+typedef struct _XENVBD_IOTRACE_RECORD {
+    ULONG64             StartUs;        // StartIo, us since boot
+    ULONG64             CompleteUs;     // SRB completion, us since boot
+    ULONG64             Lba;
+    ULONG               Length;         // bytes
+    UCHAR               Operation;      // CDB opcode
+    UCHAR               SrbStatus;
+    USHORT              Alignment;      // data buffer offset within its page
+} XENVBD_IOTRACE_RECORD, *PXENVBD_IOTRACE_RECORD;
+
+// IOCTL_SCSI_MINIPORT interface, sent to the adapter
+#define XENVBD_IOTRACE_SIGNATURE    "XENVBD  "  // SRB_IO_CONTROL.Signature
+#define XENVBD_IOTRACE_READ         0x00000001  // SRB_IO_CONTROL.ControlCode
+
+typedef struct _XENVBD_IOTRACE_READ_BUFFER {
+    SRB_IO_CONTROL          Header;
+    ULONG                   TargetId;       // in
+    ULONG                   Count;          // out, records returned
+    ULONG64                 Sequence;       // out, records ever written
+    XENVBD_IOTRACE_RECORD   Records[1];     // out, oldest first
+} XENVBD_IOTRACE_READ_BUFFER, *PXENVBD_IOTRACE_READ_BUFFER;
+
+#endif // _XENVBD_IOTRACE_H
@@ -49,7 +49,9 @@ struct _XENVBD_NOTIFIER {
     ULONG                           Port;
     ULONG                           NumInts;
     ULONG                           NumDpcs;
+    ULONG                           NumTimers;
     KDPC                            Dpc;
+    KTIMER                          Timer;
 };
 
 #define NOTIFIER_POOL_TAG           'yfNX'
@@ -148,6 +150,7 @@ NotifierCreate(
 
     (*Notifier)->Frontend = Frontend;
     KeInitializeDpc(&(*Notifier)->Dpc, NotifierDpc, *Notifier);
+    KeInitializeTimer(&(*Notifier)->Timer);
 
     return STATUS_SUCCESS;
 
@@ -162,6 +165,7 @@ NotifierDestroy(
 {
     Notifier->Frontend = NULL;
     RtlZeroMemory(&Notifier->Dpc, sizeof(KDPC));
+    RtlZeroMemory(&Notifier->Timer, sizeof(KTIMER));
 
     ASSERT(IsZeroMemory(Notifier, sizeof(XENVBD_NOTIFIER)));
     
@@ -174,8 +178,9 @@ NotifierConnect(
     IN  USHORT                      BackendDomain
     )
 {
-    PXENVBD_FDO Fdo = PdoGetFdo(FrontendGetPdo(Notifier->Frontend));
-    NTSTATUS    status;
+    PXENVBD_FDO             Fdo = PdoGetFdo(FrontendGetPdo(Notifier->Frontend));
+    PXENVBD_NUMA_PLACEMENT  Placement = FrontendGetPlacement(Notifier->Frontend);
+    NTSTATUS                status;
 
     ASSERT(Notifier->Connected == FALSE);
 
@@ -207,6 +212,22 @@ NotifierConnect(
                                    Notifier->EvtchnInterface,
                                    Notifier->Channel);
 
+    // The DPC is queued from the channel callback, so it follows the
+    // channel onto the target's node. Not fatal if the bind fails
+    if (Placement->Bound) {
+        status = XENBUS_EVTCHN(Bind,
+                               Notifier->EvtchnInterface,
+                               Notifier->Channel,
+                               Placement->Group,
+                               Placement->Number);
+        if (!NT_SUCCESS(status))
+            Warning("Target[%d] : failed to bind to CPU %u:%u (%08x)\n",
+                    FrontendGetTargetId(Notifier->Frontend),
+                    Placement->Group,
+                    Placement->Number,
+                    status);
+    }
+
     XENBUS_EVTCHN(Unmask,
                   Notifier->EvtchnInterface,
                   Notifier->Channel,
@@ -265,6 +286,7 @@ NotifierDisable(
     ASSERT(Notifier->Enabled == TRUE);
 
     Notifier->Enabled = FALSE;
+    (VOID) KeCancelTimer(&Notifier->Timer);
 }
 
 VOID
@@ -300,15 +322,15 @@ NotifierDebugCallback(
     XENBUS_DEBUG(Printf, Debug,
                  "NOTIFIER: Int / DPC : %d / %d\n",
                  Notifier->NumInts, Notifier->NumDpcs);
+    XENBUS_DEBUG(Printf, Debug,
+                 "NOTIFIER: Timed Kicks : %d\n",
+                 Notifier->NumTimers);
 
     if (Notifier->Channel) {
         XENBUS_DEBUG(Printf, Debug,
                      "NOTIFIER: Channel : %p (%d)\n", 
                      Notifier->Channel, Notifier->Port);
     }
-
-    Notifier->NumInts = 0;
-    Notifier->NumDpcs = 0;
 }
 
 VOID
@@ -323,6 +345,23 @@ NotifierKick(
     }
 }
 
+VOID
+NotifierKickAfter(
+    IN  PXENVBD_NOTIFIER            Notifier,
+    IN  ULONG                       Milliseconds
+    )
+{
+    LARGE_INTEGER   Due;
+
+    // runs the same DPC as NotifierKick once the delay has passed, re-arming
+    // a pending timer just pushes it back
+    if (Notifier->Enabled) {
+        Due.QuadPart = TIME_RELATIVE(TIME_MS((LONGLONG)Milliseconds));
+        if (!KeSetTimer(&Notifier->Timer, Due, &Notifier->Dpc))
+            ++Notifier->NumTimers;
+    }
+}
+
 VOID
 NotifierTrigger(
     IN  PXENVBD_NOTIFIER            Notifier
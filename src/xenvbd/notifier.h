@@ -88,6 +88,12 @@ NotifierKick(
     IN  PXENVBD_NOTIFIER            Notifier
     );
 
+extern VOID
+NotifierKickAfter(
+    IN  PXENVBD_NOTIFIER            Notifier,
+    IN  ULONG                       Milliseconds
+    );
+
 extern VOID
 NotifierTrigger(
     IN  PXENVBD_NOTIFIER            Notifier
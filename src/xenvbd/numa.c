@@ -0,0 +1,192 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, 
+ * with or without modification, are permitted provided 
+ * that the following conditions are met:
+ * 
+ * *   Redistributions of source code must retain the above 
+ *     copyright notice, this list of conditions and the 
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above 
+ *     copyright notice, this list of conditions and the 
+ *     following disclaimer in the documentation and/or other 
+ *     materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND 
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF 
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR 
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF 
+ * SUCH DAMAGE.
+ */ 
+
+#include "numa.h"
+#include "driver.h"
+#include "debug.h"
+#include "assert.h"
+
+// Nodes beyond this are not used for placement
+#define NUMA_MAX_NODES  64
+
+typedef PMDL
+(*NUMA_ALLOCATE_NODE_PAGES)(
+    IN  PHYSICAL_ADDRESS    LowAddress,
+    IN  PHYSICAL_ADDRESS    HighAddress,
+    IN  PHYSICAL_ADDRESS    SkipBytes,
+    IN  SIZE_T              TotalBytes,
+    IN  MEMORY_CACHING_TYPE CacheType,
+    IN  ULONG               IdealNode,
+    IN  ULONG               Flags
+    );
+
+typedef struct _XENVBD_NUMA_NODE {
+    USHORT              Node;
+    USHORT              Group;
+    KAFFINITY           Mask;
+    ULONG               Count;
+} XENVBD_NUMA_NODE, *PXENVBD_NUMA_NODE;
+
+typedef struct _XENVBD_NUMA {
+    // MmAllocateNodePagesForMdlEx is only exported from Windows 8
+    NUMA_ALLOCATE_NODE_PAGES    AllocateNodePages;
+    XENVBD_NUMA_NODE            Nodes[NUMA_MAX_NODES];
+    ULONG                       NodeCount;
+} XENVBD_NUMA, *PXENVBD_NUMA;
+
+static XENVBD_NUMA  __Numa;
+
+static FORCEINLINE UCHAR
+__NumaNthProcessor(
+    __in  KAFFINITY             Mask,
+    __in  ULONG                 Index
+    )
+{
+    UCHAR   Number;
+
+    for (Number = 0; Number < sizeof(KAFFINITY) * 8; ++Number) {
+        if ((Mask & ((KAFFINITY)1 << Number)) == 0)
+            continue;
+        if (Index-- == 0)
+            break;
+    }
+
+    return Number;
+}
+
+VOID
+NumaInitialize(
+    VOID
+    )
+{
+    UNICODE_STRING  Name;
+
+    RtlZeroMemory(&__Numa, sizeof(XENVBD_NUMA));
+
+    if (DriverParameters.NumaPolicy == XENVBD_NUMA_POLICY_OFF)
+        return;
+
+    RtlInitUnicodeString(&Name, L"MmAllocateNodePagesForMdlEx");
+#pragma warning(suppress : 4055)
+    __Numa.AllocateNodePages = (NUMA_ALLOCATE_NODE_PAGES)MmGetSystemRoutineAddress(&Name);
+
+#if (NTDDI_VERSION >= NTDDI_WIN7)
+    {
+        USHORT  Highest = KeQueryHighestNodeNumber();
+        USHORT  Node;
+
+        for (Node = 0; Node <= Highest && __Numa.NodeCount < NUMA_MAX_NODES; ++Node) {
+            PXENVBD_NUMA_NODE   Entry = &__Numa.Nodes[__Numa.NodeCount];
+            GROUP_AFFINITY      Affinity;
+            USHORT              Count;
+
+            KeQueryNodeActiveAffinity(Node, &Affinity, &Count);
+            if (Affinity.Mask == 0)
+                continue;   // memory only
+
+            Entry->Node = Node;
+            Entry->Group = Affinity.Group;
+            Entry->Mask = Affinity.Mask;
+            for (Entry->Count = 0; Affinity.Mask != 0; Affinity.Mask &= Affinity.Mask - 1)
+                ++Entry->Count;
+
+            ++__Numa.NodeCount;
+        }
+    }
+#endif
+
+    Verbose("%u nodes%s\n", __Numa.NodeCount,
+            __Numa.AllocateNodePages ? "" : " (no node allocation)");
+}
+
+VOID
+NumaPlaceTarget(
+    __in  ULONG                     TargetId,
+    __out PXENVBD_NUMA_PLACEMENT    Placement
+    )
+{
+    PXENVBD_NUMA_NODE   Node;
+
+    RtlZeroMemory(Placement, sizeof(XENVBD_NUMA_PLACEMENT));
+    Placement->Node = XENVBD_NUMA_ANY_NODE;
+
+    if (__Numa.NodeCount == 0)
+        return;
+
+    // Spread targets over the nodes in turn, and over the processors of
+    // each node as the targets wrap round
+    Node = &__Numa.Nodes[TargetId % __Numa.NodeCount];
+
+    Placement->Node = Node->Node;
+    Placement->Bound = TRUE;
+    Placement->Group = Node->Group;
+    Placement->Number = __NumaNthProcessor(Node->Mask,
+                                           (TargetId / __Numa.NodeCount) % Node->Count);
+}
+
+PMDL
+NumaAllocatePagesForMdl(
+    __in  PHYSICAL_ADDRESS          LowAddress,
+    __in  PHYSICAL_ADDRESS          HighAddress,
+    __in  PHYSICAL_ADDRESS          SkipBytes,
+    __in  SIZE_T                    TotalBytes,
+    __in  ULONG                     Node
+    )
+{
+    // the node is a preference, pages may still come from elsewhere
+    if (Node != XENVBD_NUMA_ANY_NODE && __Numa.AllocateNodePages != NULL)
+        return __Numa.AllocateNodePages(LowAddress, HighAddress, SkipBytes,
+                                        TotalBytes, MmCached, Node, 0);
+
+    return MmAllocatePagesForMdlEx(LowAddress, HighAddress, SkipBytes,
+                                   TotalBytes, MmCached, 0);
+}
+
+VOID
+NumaDebugCallback(
+    __in PXENBUS_DEBUG_INTERFACE    Debug
+    )
+{
+    ULONG   Index;
+
+    XENBUS_DEBUG(Printf, Debug,
+                 "NUMA: %u nodes, node allocation %s\n",
+                 __Numa.NodeCount,
+                 __Numa.AllocateNodePages ? "available" : "unavailable");
+
+    for (Index = 0; Index < __Numa.NodeCount; ++Index) {
+        PXENVBD_NUMA_NODE   Node = &__Numa.Nodes[Index];
+
+        XENBUS_DEBUG(Printf, Debug,
+                     "NUMA: Node %u : Group %u Mask %p (%u CPUs)\n",
+                     Node->Node, Node->Group, (PVOID)Node->Mask, Node->Count);
+    }
+}
@@ -0,0 +1,77 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, 
+ * with or without modification, are permitted provided 
+ * that the following conditions are met:
+ * 
+ * *   Redistributions of source code must retain the above 
+ *     copyright notice, this list of conditions and the 
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above 
+ *     copyright notice, this list of conditions and the 
+ *     following disclaimer in the documentation and/or other 
+ *     materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND 
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF 
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR 
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF 
+ * SUCH DAMAGE.
+ */ 
+
+#ifndef _XENVBD_NUMA_H
+#define _XENVBD_NUMA_H
+
+#include <ntddk.h>
+#include <debug_interface.h>
+
+// Placement of a target's ring, bounce and indirect pages and event
+// channel. Node is XENVBD_NUMA_ANY_NODE, and Bound FALSE, when the
+// placement policy is off or the kernel has no NUMA support
+
+#define XENVBD_NUMA_ANY_NODE    ((ULONG)-1)
+
+typedef struct _XENVBD_NUMA_PLACEMENT {
+    ULONG       Node;
+    BOOLEAN     Bound;
+    USHORT      Group;
+    UCHAR       Number;
+} XENVBD_NUMA_PLACEMENT, *PXENVBD_NUMA_PLACEMENT;
+
+extern VOID
+NumaInitialize(
+    VOID
+    );
+
+extern VOID
+NumaPlaceTarget(
+    __in  ULONG                     TargetId,
+    __out PXENVBD_NUMA_PLACEMENT    Placement
+    );
+
+// MmAllocatePagesForMdlEx, from Node if the kernel can
+extern PMDL
+NumaAllocatePagesForMdl(
+    __in  PHYSICAL_ADDRESS          LowAddress,
+    __in  PHYSICAL_ADDRESS          HighAddress,
+    __in  PHYSICAL_ADDRESS          SkipBytes,
+    __in  SIZE_T                    TotalBytes,
+    __in  ULONG                     Node
+    );
+
+extern VOID
+NumaDebugCallback(
+    __in PXENBUS_DEBUG_INTERFACE    Debug
+    );
+
+#endif // _XENVBD_NUMA_H
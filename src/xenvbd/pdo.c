@@ -36,6 +36,9 @@
 #include "queue.h"
 #include "srbext.h"
 #include "buffer.h"
+#include "histogram.h"
+#include "etw.h"
+#include "profile.h"
 #include "pdoinquiry.h"
 #include "debug.h"
 #include "assert.h"
@@ -62,6 +65,63 @@ typedef struct _XENVBD_SG_LIST {
 
 #define PDO_SIGNATURE           'odpX'
 
+// Latency is tracked per operation and, for reads and writes, per SRB size
+typedef enum _XENVBD_LATENCY_OP {
+    LatencyRead = 0,
+    LatencyWrite,
+    LatencyIndirectRead,
+    LatencyIndirectWrite,
+    LatencyBarrier,
+    LatencyDiscard,
+    LatencyOps
+} XENVBD_LATENCY_OP;
+
+typedef enum _XENVBD_LATENCY_SIZE {
+    LatencyUpTo4K = 0,
+    LatencyUpTo64K,
+    LatencyUpTo512K,
+    LatencyOver512K,
+    LatencySizes
+} XENVBD_LATENCY_SIZE;
+
+typedef struct _XENVBD_LATENCY {
+    XENVBD_HISTOGRAM            Queue;      // StartIo -> ring
+    XENVBD_HISTOGRAM            Device;     // ring -> response
+} XENVBD_LATENCY, *PXENVBD_LATENCY;
+
+#if defined(XENVBD_PROFILE)
+
+// Segment building cost is tracked by the shape of the SRB's SG list. This
+// walks the segments a second time, so is only built in profiling drivers
+typedef enum _XENVBD_SG_SHAPE {
+    SgShapeAligned = 0,     // page aligned elements
+    SgShapeSectorOffset,    // sector aligned, not page aligned
+    SgShapeMisaligned,      // an element is not sector aligned
+    SgShapeFragmented,      // page aligned, but an element ends mid-page
+    SgShapes
+} XENVBD_SG_SHAPE;
+
+typedef struct _XENVBD_SG_STATS {
+    ULONG64                     Srbs;
+    ULONG64                     Segments;
+    ULONG64                     Bounced;
+    ULONG64                     Cycles;     // TSC cycles building segments
+} XENVBD_SG_STATS, *PXENVBD_SG_STATS;
+
+#endif  // XENVBD_PROFILE
+
+// Counters at the last PdoPublishStats, rates are computed from deltas
+typedef struct _XENVBD_PUBLISHED {
+    ULONG64                     Time;
+    ULONG64                     Srbs;
+    ULONG64                     BytesRead;
+    ULONG64                     BytesWritten;
+    ULONG64                     SegsGranted;
+    ULONG64                     SegsBounced;
+    ULONG64                     Outliers;
+    XENVBD_HISTOGRAM            Device;
+} XENVBD_PUBLISHED, *PXENVBD_PUBLISHED;
+
 typedef struct _XENVBD_LOOKASIDE {
     KEVENT                      Empty;
     LONG                        Used;
@@ -71,6 +131,49 @@ typedef struct _XENVBD_LOOKASIDE {
     NPAGED_LOOKASIDE_LIST       List;
 } XENVBD_LOOKASIDE, *PXENVBD_LOOKASIDE;
 
+// Hot-path counters, summed by __PdoSumStats on read
+typedef struct _XENVBD_PDO_STATS {
+    // SRB Counts by BLKIF_OP_
+    ULONG64                     BlkOpRead;
+    ULONG64                     BlkOpWrite;
+    ULONG64                     BlkOpIndirectRead;
+    ULONG64                     BlkOpIndirectWrite;
+    ULONG64                     BlkOpBarrier;
+    ULONG64                     BlkOpDiscard;
+    // Bytes transferred by successful SRBs
+    ULONG64                     BytesRead;
+    ULONG64                     BytesWritten;
+    // SRBs submitted from StartIo / handed to the DPC
+    ULONG64                     DirectSrbs;
+    ULONG64                     DeferredSrbs;
+    // SRBs completed by the backend's responses
+    ULONG64                     CompletedSrbs;
+    // Failures
+    ULONG64                     FailedMaps;
+    ULONG64                     FailedBounces;
+    ULONG64                     FailedGrants;
+    ULONG64                     RingFull;
+    // Segments
+    ULONG64                     SegsGranted;
+    ULONG64                     SegsBounced;
+} XENVBD_PDO_STATS, *PXENVBD_PDO_STATS;
+
+// Padding the per-CPU slots and the hot groups below out to a cache line is
+// the point of DECLSPEC_CACHEALIGN, so C4324 (structure was padded due to
+// alignment specifier) is expected here
+#pragma warning(push)
+#pragma warning(disable:4324)
+
+// One slot per CPU so StartIo and the DPC on different CPUs never write the
+// same cache line. Readers merge the slots
+typedef struct _XENVBD_PDO_CPU {
+    XENVBD_PDO_STATS            Stats;
+#if defined(XENVBD_PROFILE)
+    // Segment building, by SG list shape
+    XENVBD_SG_STATS             SgStats[SgShapes];
+#endif
+} DECLSPEC_CACHEALIGN XENVBD_PDO_CPU, *PXENVBD_PDO_CPU;
+
 struct _XENVBD_PDO {
     ULONG                       Signature;
     PXENVBD_FDO                 Fdo;
@@ -80,7 +183,6 @@ struct _XENVBD_PDO {
     DEVICE_PNP_STATE            DevicePnpState;
     DEVICE_PNP_STATE            PrevPnpState;
     DEVICE_POWER_STATE          DevicePowerState;
-    KSPIN_LOCK                  Lock;
 
     // Frontend (Ring, includes XenBus interfaces)
     PXENVBD_FRONTEND            Frontend;
@@ -88,7 +190,6 @@ struct _XENVBD_PDO {
 
     // State
     BOOLEAN                     EmulatedUnplugged;
-    LONG                        Paused;
 
     // Eject
     BOOLEAN                     WrittenEjected;
@@ -101,34 +202,97 @@ struct _XENVBD_PDO {
     XENVBD_LOOKASIDE            RequestList;
     XENVBD_LOOKASIDE            SegmentList;
     XENVBD_LOOKASIDE            IndirectList;
+    XENVBD_QUEUE                ShutdownSrbs;
+
+    // Hot fields, grouped on separate cache lines by the side that writes
+    // them (offsets are relative to the start of the PDO)
+    // Producer - StartIo on any CPU appends to FreshSrbs
+    DECLSPEC_CACHEALIGN
     XENVBD_QUEUE                FreshSrbs;
+    // Submit - the DPC preparing and submitting requests
+    DECLSPEC_CACHEALIGN
+    KSPIN_LOCK                  Lock;
+    LONG                        Paused;
+    KSPIN_LOCK                  SubmitLock;
+    ULONG                       NextTag;
     XENVBD_QUEUE                PreparedReqs;
+    // Consumer - the DPC completing responses
+    DECLSPEC_CACHEALIGN
     XENVBD_QUEUE                SubmittedReqs;
-    XENVBD_QUEUE                ShutdownSrbs;
-    ULONG                       NextTag;
-
-    // Stats - SRB Counts by BLKIF_OP_
-    ULONG                       BlkOpRead;
-    ULONG                       BlkOpWrite;
-    ULONG                       BlkOpIndirectRead;
-    ULONG                       BlkOpIndirectWrite;
-    ULONG                       BlkOpBarrier;
-    ULONG                       BlkOpDiscard;
-    // Stats - Failures
-    ULONG                       FailedMaps;
-    ULONG                       FailedBounces;
-    ULONG                       FailedGrants;
-    // Stats - Segments
-    ULONG64                     SegsGranted;
-    ULONG64                     SegsBounced;
+    ULONG64                     OldestSubmitTime;
+    BOOLEAN                     Draining;
+
+    // Resume - PreparedReqs kept across a resume, waiting for new grants
+    BOOLEAN                     Resuming;
+    ULONG64                     ResumeReplayed;
+    ULONG64                     ResumeRebuilt;
+
+    // Drain - DrainEvent is set by the completion that empties SubmittedReqs
+    KEVENT                      DrainEvent;
+    ULONG64                     DrainTimeouts;
+    ULONG64                     DrainEscalations;
+    XENVBD_HISTOGRAM            DrainWait;
+    XENVBD_HISTOGRAM            DrainAbort;
+
+    // Stats - per-CPU slots, StatsBuffer is the unaligned allocation
+    PVOID                       StatsBuffer;
+    PXENVBD_PDO_CPU             Cpu;
+    ULONG                       StatsCpus;
+    // Stats - PreparedReqs backlog when the ring was full
+    ULONG64                     BacklogTotal;
+    ULONG                       BacklogMaximum;
+
+    // Memory Budget - MemoryUsed is held by requests, segments, indirect
+    // and bounce pages now, MemoryCredit was granted by the FDO to cover it
+    LONG64                      MemoryUsed;
+    LONG64                      MemoryCredit;
+    LONG64                      MemoryReserved;
+    ULONG64                     MemoryRefused;
+
+    // Busy - an SRB could not be prepared, StorPort is held off (2) while
+    // a completion is due to restart the target
+    LONG                        Busy;
+    ULONG64                     BusyEpisodes;
+    // Stats - Latency (us), shared as the histograms are too large to copy
+    // per CPU, HistogramAdd is interlocked
+    XENVBD_LATENCY              Latency[LatencyOps][LatencySizes];
+    // Stats - Snapshot at the last xenstore publish
+    XENVBD_PUBLISHED            Published;
+    // I/O trace - last XENVBD_IOTRACE_RECORDS completed SRBs
+    LONG64                      TraceSequence;
+    XENVBD_IOTRACE_RECORD       Trace[XENVBD_IOTRACE_RECORDS];
+    // Outliers - last XENVBD_WMI_OUTLIERS requests slower than SlowThreshold
+    LONG64                      OutlierSequence;
+    XENVBD_OUTLIER              Outliers[XENVBD_WMI_OUTLIERS];
+    ULONG64                     OutlierWarned;
+    ULONG                       OutlierQuiet;
 };
 
+#pragma warning(pop)
+
 //=============================================================================
 #define PDO_POOL_TAG            'odPX'
 #define REQUEST_POOL_TAG        'qeRX'
 #define SEGMENT_POOL_TAG        'geSX'
 #define INDIRECT_POOL_TAG       'dnIX'
 
+// Credit is taken from the FDO in steps of this many bytes
+#define PDO_MEMORY_CHUNK        (16 * PAGE_SIZE)
+
+#define PDO_INDIRECT_MEMORY     (sizeof(XENVBD_INDIRECT) + PAGE_SIZE)
+
+// A target that cannot prepare an SRB with nothing in flight tries again
+// after this many milliseconds, as no completion is due to restart it
+#define PDO_BUSY_RETRY          10
+
+// CPUs beyond this share a stats slot
+#define PDO_MAX_CPUS            64
+
+// pool allocations carry a header, so the slots are over-allocated by a
+// cache line and aligned by hand
+#define PDO_STATS_BYTES(_Cpus)  \
+        (((_Cpus) * sizeof(XENVBD_PDO_CPU)) + SYSTEM_CACHE_ALIGNMENT_SIZE)
+
 __checkReturn
 __drv_allocatesMem(mem)
 __bcount(Size)
@@ -154,6 +318,257 @@ __PdoFree(
         __FreePoolWithTag(Buffer, PDO_POOL_TAG);
 }
 
+//=============================================================================
+// Per-CPU Stats
+static FORCEINLINE PXENVBD_PDO_CPU
+__PdoCpu(
+    __in PXENVBD_PDO             Pdo
+    )
+{
+    // CPUs added after PdoCreate, or beyond PDO_MAX_CPUS, share a slot
+    return &Pdo->Cpu[KeGetCurrentProcessorNumberEx(NULL) % Pdo->StatsCpus];
+}
+
+static FORCEINLINE PXENVBD_PDO_STATS
+__PdoStats(
+    __in PXENVBD_PDO             Pdo
+    )
+{
+    return &__PdoCpu(Pdo)->Stats;
+}
+
+#if defined(XENVBD_PROFILE)
+
+static VOID
+__PdoSumSgStats(
+    __in PXENVBD_PDO             Pdo,
+    __in ULONG                   Shape,
+    __out PXENVBD_SG_STATS       Total
+    )
+{
+    ULONG   Cpu;
+
+    RtlZeroMemory(Total, sizeof(XENVBD_SG_STATS));
+
+    for (Cpu = 0; Cpu < Pdo->StatsCpus; ++Cpu) {
+        PXENVBD_SG_STATS    Stats = &Pdo->Cpu[Cpu].SgStats[Shape];
+
+        Total->Srbs     += Stats->Srbs;
+        Total->Segments += Stats->Segments;
+        Total->Bounced  += Stats->Bounced;
+        Total->Cycles   += Stats->Cycles;
+    }
+}
+
+#endif  // XENVBD_PROFILE
+
+static VOID
+__PdoSumStats(
+    __in PXENVBD_PDO             Pdo,
+    __out PXENVBD_PDO_STATS      Total
+    )
+{
+    ULONG   Cpu;
+
+    RtlZeroMemory(Total, sizeof(XENVBD_PDO_STATS));
+
+    for (Cpu = 0; Cpu < Pdo->StatsCpus; ++Cpu) {
+        PXENVBD_PDO_STATS   Stats = &Pdo->Cpu[Cpu].Stats;
+
+        Total->BlkOpRead            += Stats->BlkOpRead;
+        Total->BlkOpWrite           += Stats->BlkOpWrite;
+        Total->BlkOpIndirectRead    += Stats->BlkOpIndirectRead;
+        Total->BlkOpIndirectWrite   += Stats->BlkOpIndirectWrite;
+        Total->BlkOpBarrier         += Stats->BlkOpBarrier;
+        Total->BlkOpDiscard         += Stats->BlkOpDiscard;
+        Total->BytesRead            += Stats->BytesRead;
+        Total->BytesWritten         += Stats->BytesWritten;
+        Total->DirectSrbs           += Stats->DirectSrbs;
+        Total->DeferredSrbs         += Stats->DeferredSrbs;
+        Total->CompletedSrbs        += Stats->CompletedSrbs;
+        Total->FailedMaps           += Stats->FailedMaps;
+        Total->FailedBounces        += Stats->FailedBounces;
+        Total->FailedGrants         += Stats->FailedGrants;
+        Total->RingFull             += Stats->RingFull;
+        Total->SegsGranted          += Stats->SegsGranted;
+        Total->SegsBounced          += Stats->SegsBounced;
+    }
+}
+
+static NTSTATUS
+__PdoAllocateStats(
+    __in PXENVBD_PDO             Pdo
+    )
+{
+    ULONG   Cpus = KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS);
+
+    if (Cpus > PDO_MAX_CPUS)
+        Cpus = PDO_MAX_CPUS;
+
+    // the slots are held for the life of the target, so they come out of
+    // the memory budget. If the budget is too tight for one per CPU, all
+    // CPUs share a single slot
+    if (!FdoChargeMemory(Pdo->Fdo, PDO_STATS_BYTES(Cpus), FALSE)) {
+        Cpus = 1;
+        (VOID) FdoChargeMemory(Pdo->Fdo, PDO_STATS_BYTES(Cpus), TRUE);
+    }
+
+    Pdo->StatsBuffer = __PdoAlloc(PDO_STATS_BYTES(Cpus));
+    if (Pdo->StatsBuffer == NULL) {
+        FdoUnchargeMemory(Pdo->Fdo, PDO_STATS_BYTES(Cpus));
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    Pdo->Cpu = (PXENVBD_PDO_CPU)ALIGN_UP_POINTER_BY(Pdo->StatsBuffer,
+                                                    SYSTEM_CACHE_ALIGNMENT_SIZE);
+    Pdo->StatsCpus = Cpus;
+    return STATUS_SUCCESS;
+}
+
+static VOID
+__PdoFreeStats(
+    __in PXENVBD_PDO             Pdo
+    )
+{
+    __PdoFree(Pdo->StatsBuffer);
+    FdoUnchargeMemory(Pdo->Fdo, PDO_STATS_BYTES(Pdo->StatsCpus));
+    Pdo->StatsBuffer = NULL;
+    Pdo->Cpu = NULL;
+    Pdo->StatsCpus = 0;
+}
+
+//=============================================================================
+// Memory Budget
+static FORCEINLINE LONG64
+__PdoMemoryChunks(
+    __in LONG64                  Bytes
+    )
+{
+    return ((Bytes + PDO_MEMORY_CHUNK - 1) / PDO_MEMORY_CHUNK) * PDO_MEMORY_CHUNK;
+}
+
+static BOOLEAN
+__PdoCoverMemory(
+    __in PXENVBD_PDO             Pdo,
+    __in LONG64                  Needed,
+    __in BOOLEAN                 Idle
+    )
+{
+    for (;;) {
+        LONG64  Credit = Pdo->MemoryCredit;
+        LONG64  Grant;
+
+        if (Needed <= Credit)
+            return TRUE;
+
+        Grant = __PdoMemoryChunks(Needed - Credit);
+        if (!FdoAcquireMemory(Pdo->Fdo, Credit, Grant, Idle))
+            return FALSE;
+
+        if (InterlockedCompareExchange64(&Pdo->MemoryCredit,
+                                         Credit + Grant,
+                                         Credit) == Credit)
+            return TRUE;
+
+        // raced with another charge or a reclaim, give it back and retry
+        FdoReleaseMemory(Pdo->Fdo, Credit + Grant, Grant);
+    }
+}
+
+static BOOLEAN
+__PdoChargeMemory(
+    __in PXENVBD_PDO             Pdo,
+    __in ULONG                   Bytes
+    )
+{
+    LONG64  Used;
+
+    Used = InterlockedExchangeAdd64(&Pdo->MemoryUsed, Bytes) + Bytes;
+
+    if (__PdoCoverMemory(Pdo, Used, FALSE))
+        return TRUE;
+
+    (VOID) InterlockedExchangeAdd64(&Pdo->MemoryUsed, -(LONG64)Bytes);
+    ++Pdo->MemoryRefused;
+    return FALSE;
+}
+
+VOID
+PdoReclaimMemory(
+    __in PXENVBD_PDO             Pdo
+    )
+{
+    for (;;) {
+        LONG64  Credit = Pdo->MemoryCredit;
+        LONG64  Keep = __PdoMemoryChunks(Pdo->MemoryUsed + Pdo->MemoryReserved);
+
+        if (Keep >= Credit)
+            return;
+
+        // a charge racing with this may briefly run ahead of the credit,
+        // the next charge covers the difference
+        if (InterlockedCompareExchange64(&Pdo->MemoryCredit,
+                                         Keep,
+                                         Credit) == Credit) {
+            FdoReleaseMemory(Pdo->Fdo, Credit, Credit - Keep);
+            return;
+        }
+    }
+}
+
+static FORCEINLINE VOID
+__PdoUnchargeMemory(
+    __in PXENVBD_PDO             Pdo,
+    __in ULONG                   Bytes
+    )
+{
+    LONG64  Used;
+
+    Used = InterlockedExchangeAdd64(&Pdo->MemoryUsed, -(LONG64)Bytes);
+    ASSERT3S(Used, >=, (LONG64)Bytes);
+
+    // credit stays with the target until the FDO reclaims it, or it is
+    // handed back at the end of a completion batch (PdoSubmitRequests)
+}
+
+// Makes sure the target's credit covers Bytes more than it has in use and
+// already reserved, so the charges made while building an SRB cannot be
+// refused. A target with nothing in use is always granted
+static BOOLEAN
+__PdoReserveMemory(
+    __in PXENVBD_PDO             Pdo,
+    __in LONG64                  Bytes
+    )
+{
+    LONG64  Reserved;
+    BOOLEAN Idle;
+
+    if (Bytes == 0)
+        return TRUE;
+
+    Idle = (Pdo->MemoryUsed == 0) ? TRUE : FALSE;
+    Reserved = InterlockedExchangeAdd64(&Pdo->MemoryReserved, Bytes) + Bytes;
+
+    if (__PdoCoverMemory(Pdo, Pdo->MemoryUsed + Reserved, Idle))
+        return TRUE;
+
+    (VOID) InterlockedExchangeAdd64(&Pdo->MemoryReserved, -Bytes);
+    ++Pdo->MemoryRefused;
+    return FALSE;
+}
+
+static FORCEINLINE VOID
+__PdoUnreserveMemory(
+    __in PXENVBD_PDO             Pdo,
+    __in LONG64                  Bytes
+    )
+{
+    if (Bytes == 0)
+        return;
+
+    (VOID) InterlockedExchangeAdd64(&Pdo->MemoryReserved, -Bytes);
+}
+
 //=============================================================================
 // Lookasides
 static FORCEINLINE VOID
@@ -232,9 +647,23 @@ __LookasideDebug(
                  "LOOKASIDE: %s: %u / %u (%u failed)\n",
                  Name, Lookaside->Used,
                  Lookaside->Max, Lookaside->Failed);
+}
 
-    Lookaside->Max = Lookaside->Used;
-    Lookaside->Failed = 0;
+static FORCEINLINE PCHAR
+BlkifOperationName(
+    IN  UCHAR                   Operation
+    )
+{
+    switch (Operation) {
+    case BLKIF_OP_READ:             return "READ";
+    case BLKIF_OP_WRITE:            return "WRITE";
+    case BLKIF_OP_WRITE_BARRIER:    return "WRITE_BARRIER";
+    case BLKIF_OP_FLUSH_DISKCACHE:  return "FLUSH_DISKCACHE";
+    case BLKIF_OP_RESERVED_1:       return "RESERVED_1";
+    case BLKIF_OP_DISCARD:          return "DISCARD";
+    case BLKIF_OP_INDIRECT:         return "INDIRECT";
+    default:                        return "<unknown>";
+    }
 }
 
 //=============================================================================
@@ -259,17 +688,224 @@ __PnpStateName(
     }
 }
 
+static FORCEINLINE PCHAR
+__LatencyOpName(
+    IN  XENVBD_LATENCY_OP       Op
+    )
+{
+    switch (Op) {
+    case LatencyRead:           return "READ";
+    case LatencyWrite:          return "WRITE";
+    case LatencyIndirectRead:   return "INDIRECT_READ";
+    case LatencyIndirectWrite:  return "INDIRECT_WRITE";
+    case LatencyBarrier:        return "BARRIER";
+    case LatencyDiscard:        return "DISCARD";
+    default:                    return "UNKNOWN";
+    }
+}
+
+static FORCEINLINE PCHAR
+__LatencySizeName(
+    IN  XENVBD_LATENCY_SIZE     Size
+    )
+{
+    switch (Size) {
+    case LatencyUpTo4K:         return "<=4K";
+    case LatencyUpTo64K:        return "<=64K";
+    case LatencyUpTo512K:       return "<=512K";
+    case LatencyOver512K:       return ">512K";
+    default:                    return "UNKNOWN";
+    }
+}
+
+static DECLSPEC_NOINLINE VOID
+__PdoLatencyDebug(
+    IN  PXENVBD_PDO             Pdo,
+    IN  PXENBUS_DEBUG_INTERFACE Debug
+    )
+{
+    ULONG   Op;
+    ULONG   Size;
+    CHAR    Name[48];
+
+    for (Op = 0; Op < LatencyOps; ++Op) {
+        for (Size = 0; Size < LatencySizes; ++Size) {
+            PXENVBD_LATENCY Latency = &Pdo->Latency[Op][Size];
+
+            (VOID) RtlStringCbPrintfA(Name, sizeof(Name), "%s %s QUEUE",
+                                      __LatencyOpName(Op),
+                                      __LatencySizeName(Size));
+            HistogramDebugCallback(&Latency->Queue, Name, Debug);
+
+            (VOID) RtlStringCbPrintfA(Name, sizeof(Name), "%s %s DEVICE",
+                                      __LatencyOpName(Op),
+                                      __LatencySizeName(Size));
+            HistogramDebugCallback(&Latency->Device, Name, Debug);
+        }
+    }
+}
+
+static ULONG64
+__PdoOldestSubmitted(
+    __in PXENVBD_PDO             Pdo
+    )
+{
+    // Called at HIGH_LEVEL from the debug callback, so the queue lock cannot
+    // be taken and the head request may already have been freed. Only the
+    // copy of its SubmitTime kept in the PDO is read
+    return *(volatile ULONG64 *)&Pdo->OldestSubmitTime;
+}
+
+static VOID
+__PdoBacklogDebug(
+    __in PXENVBD_PDO             Pdo,
+    __in ULONG64                 RingFull,
+    __in PXENBUS_DEBUG_INTERFACE DebugInterface
+    )
+{
+    ULONG64 SubmitTime = __PdoOldestSubmitted(Pdo);
+    ULONG64 Now = HistogramNow();
+
+    XENBUS_DEBUG(Printf, DebugInterface,
+                 "PDO: Backlog: Prepared=%u RingFull avg=%llu max=%u\n",
+                 QueueCount(&Pdo->PreparedReqs),
+                 RingFull ? Pdo->BacklogTotal / RingFull : 0,
+                 Pdo->BacklogMaximum);
+    XENBUS_DEBUG(Printf, DebugInterface,
+                 "PDO: Oldest Submitted: %lluus\n",
+                 (SubmitTime != 0 && Now > SubmitTime) ?
+                        HistogramTicksToUs(Now - SubmitTime) : 0);
+}
+
+#if defined(XENVBD_PROFILE)
+
+static FORCEINLINE PCHAR
+__SgShapeName(
+    __in XENVBD_SG_SHAPE         Shape
+    )
+{
+    switch (Shape) {
+    case SgShapeAligned:        return "ALIGNED";
+    case SgShapeSectorOffset:   return "SECTOR_OFFSET";
+    case SgShapeMisaligned:     return "MISALIGNED";
+    case SgShapeFragmented:     return "FRAGMENTED";
+    default:                    return "UNKNOWN";
+    }
+}
+
+static VOID
+__PdoSgStatsDebug(
+    __in PXENVBD_PDO             Pdo,
+    __in PXENBUS_DEBUG_INTERFACE DebugInterface
+    )
+{
+    ULONG               Shape;
+    XENVBD_SG_STATS     Total;
+
+    for (Shape = 0; Shape < SgShapes; ++Shape) {
+        PXENVBD_SG_STATS    Stats = &Total;
+
+        __PdoSumSgStats(Pdo, Shape, Stats);
+        if (Stats->Srbs == 0)
+            continue;
+
+        XENBUS_DEBUG(Printf, DebugInterface,
+                     "PDO: SGList %s (%u byte sectors): %llu SRBs %llu segments, %llu cycles/segment, %llu%% bounced\n",
+                     __SgShapeName(Shape),
+                     PdoSectorSize(Pdo),
+                     Stats->Srbs,
+                     Stats->Segments,
+                     Stats->Segments ? Stats->Cycles / Stats->Segments : 0,
+                     Stats->Segments ? (Stats->Bounced * 100) / Stats->Segments : 0);
+    }
+}
+
+#endif  // XENVBD_PROFILE
+
+#define PDO_TRACE_DEBUG_RECORDS 32
+
+static VOID
+__PdoTraceDebug(
+    __in PXENVBD_PDO             Pdo,
+    __in PXENBUS_DEBUG_INTERFACE DebugInterface
+    )
+{
+    LONG64  Sequence = Pdo->TraceSequence;
+    LONG64  Index;
+
+    XENBUS_DEBUG(Printf, DebugInterface,
+                 "PDO: Trace: %lld records\n",
+                 Sequence);
+
+    Index = Sequence - __min(Sequence, PDO_TRACE_DEBUG_RECORDS);
+    for (; Index < Sequence; ++Index) {
+        PXENVBD_IOTRACE_RECORD  Record;
+
+        Record = &Pdo->Trace[Index & (XENVBD_IOTRACE_RECORDS - 1)];
+        XENBUS_DEBUG(Printf, DebugInterface,
+                     "PDO: Trace: %lld: %lluus +%lluus OP %02x LBA %llx LEN %x ALIGN %x STATUS %02x\n",
+                     Index,
+                     Record->StartUs,
+                     Record->CompleteUs - Record->StartUs,
+                     Record->Operation,
+                     Record->Lba,
+                     Record->Length,
+                     Record->Alignment,
+                     Record->SrbStatus);
+    }
+}
+
+static VOID
+__PdoOutlierDebug(
+    __in PXENVBD_PDO             Pdo,
+    __in PXENBUS_DEBUG_INTERFACE DebugInterface
+    )
+{
+    LONG64  Last = Pdo->OutlierSequence;
+    LONG64  Index;
+
+    XENBUS_DEBUG(Printf, DebugInterface,
+                 "PDO: Outliers: %lld (> %ums)\n",
+                 Last,
+                 DriverParameters.SlowThreshold);
+
+    for (Index = Last - __min(Last, XENVBD_WMI_OUTLIERS); Index < Last; ++Index) {
+        PXENVBD_OUTLIER Outlier = &Pdo->Outliers[Index & (XENVBD_WMI_OUTLIERS - 1)];
+
+        XENBUS_DEBUG(Printf, DebugInterface,
+                     "PDO: Outlier: %lld: @%lluus Tag %x %s LBA %llx LEN %x SEGS %u (%u bounced%s) RING %u DOM %u QUEUE %lluus DEVICE %lluus%s\n",
+                     Index,
+                     Outlier->StartUs,
+                     Outlier->Tag,
+                     BlkifOperationName(Outlier->Operation),
+                     Outlier->Lba,
+                     Outlier->Length,
+                     Outlier->Segments,
+                     Outlier->Bounced,
+                     Outlier->Indirect ? ", indirect" : "",
+                     Outlier->RingIndex,
+                     Outlier->BackendDomain,
+                     Outlier->QueueUs,
+                     Outlier->DeviceUs,
+                     Outlier->Outstanding ? " (outstanding)" : "");
+    }
+}
+
 DECLSPEC_NOINLINE VOID
 PdoDebugCallback(
     __in PXENVBD_PDO Pdo,
     __in PXENBUS_DEBUG_INTERFACE DebugInterface
     )
 {
+    XENVBD_PDO_STATS    Stats;
+
     if (Pdo == NULL || DebugInterface == NULL)
         return;
     if (Pdo->Signature != PDO_SIGNATURE)
         return;
 
+    __PdoSumStats(Pdo, &Stats);
+
     XENBUS_DEBUG(Printf, DebugInterface,
                  "PDO: Fdo 0x%p DeviceObject 0x%p\n",
                  Pdo->Fdo,
@@ -290,20 +926,52 @@ PdoDebugCallback(
                  Pdo->Missing ? Pdo->Reason : "Not Missing");
 
     XENBUS_DEBUG(Printf, DebugInterface,
-                 "PDO: BLKIF_OPs: READ=%u WRITE=%u\n",
-                 Pdo->BlkOpRead, Pdo->BlkOpWrite);
+                 "PDO: BLKIF_OPs: READ=%llu WRITE=%llu\n",
+                 Stats.BlkOpRead, Stats.BlkOpWrite);
     XENBUS_DEBUG(Printf, DebugInterface,
-                 "PDO: BLKIF_OPs: INDIRECT_READ=%u INDIRECT_WRITE=%u\n",
-                 Pdo->BlkOpIndirectRead, Pdo->BlkOpIndirectWrite);
+                 "PDO: BLKIF_OPs: INDIRECT_READ=%llu INDIRECT_WRITE=%llu\n",
+                 Stats.BlkOpIndirectRead, Stats.BlkOpIndirectWrite);
     XENBUS_DEBUG(Printf, DebugInterface,
-                 "PDO: BLKIF_OPs: BARRIER=%u DISCARD=%u\n",
-                 Pdo->BlkOpBarrier, Pdo->BlkOpDiscard);
+                 "PDO: BLKIF_OPs: BARRIER=%llu DISCARD=%llu\n",
+                 Stats.BlkOpBarrier, Stats.BlkOpDiscard);
     XENBUS_DEBUG(Printf, DebugInterface,
-                 "PDO: Failed: Maps=%u Bounces=%u Grants=%u\n",
-                 Pdo->FailedMaps, Pdo->FailedBounces, Pdo->FailedGrants);
+                 "PDO: Bytes: READ=%llu WRITTEN=%llu\n",
+                 Stats.BytesRead, Stats.BytesWritten);
+    XENBUS_DEBUG(Printf, DebugInterface,
+                 "PDO: SRBs: DIRECT=%llu DEFERRED=%llu COMPLETED=%llu\n",
+                 Stats.DirectSrbs, Stats.DeferredSrbs, Stats.CompletedSrbs);
+    XENBUS_DEBUG(Printf, DebugInterface,
+                 "PDO: Failed: Maps=%llu Bounces=%llu Grants=%llu RingFull=%llu\n",
+                 Stats.FailedMaps, Stats.FailedBounces, Stats.FailedGrants, Stats.RingFull);
     XENBUS_DEBUG(Printf, DebugInterface,
                  "PDO: Segments Granted=%llu Bounced=%llu\n",
-                 Pdo->SegsGranted, Pdo->SegsBounced);
+                 Stats.SegsGranted, Stats.SegsBounced);
+    XENBUS_DEBUG(Printf, DebugInterface,
+                 "PDO: Resume: Replayed=%llu Rebuilt=%llu%s\n",
+                 Pdo->ResumeReplayed, Pdo->ResumeRebuilt,
+                 Pdo->Resuming ? " (RESUMING)" : "");
+    XENBUS_DEBUG(Printf, DebugInterface,
+                 "PDO: Drain: Timeouts=%llu Escalations=%llu%s\n",
+                 Pdo->DrainTimeouts, Pdo->DrainEscalations,
+                 Pdo->Draining ? " (DRAINING)" : "");
+    XENBUS_DEBUG(Printf, DebugInterface,
+                 "PDO: Memory: Used=%lld Credit=%lld Reserved=%lld Refused=%llu\n",
+                 Pdo->MemoryUsed, Pdo->MemoryCredit, Pdo->MemoryReserved,
+                 Pdo->MemoryRefused);
+    XENBUS_DEBUG(Printf, DebugInterface,
+                 "PDO: Busy: Episodes=%llu%s\n",
+                 Pdo->BusyEpisodes,
+                 Pdo->Busy ? " (BUSY)" : "");
+    HistogramDebugCallback(&Pdo->DrainWait, "DRAIN WAIT", DebugInterface);
+    HistogramDebugCallback(&Pdo->DrainAbort, "DRAIN ABORT", DebugInterface);
+
+    __PdoBacklogDebug(Pdo, Stats.RingFull, DebugInterface);
+    __PdoLatencyDebug(Pdo, DebugInterface);
+#if defined(XENVBD_PROFILE)
+    __PdoSgStatsDebug(Pdo, DebugInterface);
+#endif
+    __PdoTraceDebug(Pdo, DebugInterface);
+    __PdoOutlierDebug(Pdo, DebugInterface);
 
     __LookasideDebug(&Pdo->RequestList, DebugInterface, "REQUESTs");
     __LookasideDebug(&Pdo->SegmentList, DebugInterface, "SEGMENTs");
@@ -315,12 +983,183 @@ PdoDebugCallback(
     QueueDebugCallback(&Pdo->ShutdownSrbs, "Shutdown ", DebugInterface);
 
     FrontendDebugCallback(Pdo->Frontend, DebugInterface);
+}
+
+VOID
+PdoQueryWmiStats(
+    __in PXENVBD_PDO                Pdo,
+    __out PXENVBD_WMI_TARGET_STATS  Stats
+    )
+{
+    XENVBD_PDO_STATS    Total;
+
+    __PdoSumStats(Pdo, &Total);
+
+    Stats->TargetId             = PdoGetTargetId(Pdo);
+    Stats->Present              = 1;
+
+    Stats->BlkOpRead            = Total.BlkOpRead;
+    Stats->BlkOpWrite           = Total.BlkOpWrite;
+    Stats->BlkOpIndirectRead    = Total.BlkOpIndirectRead;
+    Stats->BlkOpIndirectWrite   = Total.BlkOpIndirectWrite;
+    Stats->BlkOpBarrier         = Total.BlkOpBarrier;
+    Stats->BlkOpDiscard         = Total.BlkOpDiscard;
+    Stats->BytesRead            = Total.BytesRead;
+    Stats->BytesWritten         = Total.BytesWritten;
+
+    Stats->SegsGranted          = Total.SegsGranted;
+    Stats->SegsBounced          = Total.SegsBounced;
+    Stats->FailedMaps           = Total.FailedMaps;
+    Stats->FailedBounces        = Total.FailedBounces;
+    Stats->FailedGrants         = Total.FailedGrants;
+    Stats->RingFull             = Total.RingFull;
+
+    Stats->FreshSrbs            = QueueCount(&Pdo->FreshSrbs);
+    Stats->FreshSrbsMaximum     = Pdo->FreshSrbs.Maximum;
+    Stats->PreparedReqs         = QueueCount(&Pdo->PreparedReqs);
+    Stats->PreparedReqsMaximum  = Pdo->PreparedReqs.Maximum;
+    Stats->SubmittedReqs        = QueueCount(&Pdo->SubmittedReqs);
+    Stats->SubmittedReqsMaximum = Pdo->SubmittedReqs.Maximum;
+
+    Stats->MemoryUsed           = (ULONG64)Pdo->MemoryUsed;
+    Stats->MemoryCredit         = (ULONG64)Pdo->MemoryCredit;
+    Stats->MemoryRefused        = Pdo->MemoryRefused;
+}
+
+VOID
+PdoReadTrace(
+    __in PXENVBD_PDO                Pdo,
+    __out_ecount(Maximum) PXENVBD_IOTRACE_RECORD Records,
+    __in ULONG                      Maximum,
+    __out PULONG                    Count,
+    __out PULONG64                  Sequence
+    )
+{
+    LONG64  Last = Pdo->TraceSequence;
+    LONG64  Index;
+    ULONG   Copied = 0;
+
+    Maximum = __min(Maximum, XENVBD_IOTRACE_RECORDS);
+
+    for (Index = Last - __min(Last, (LONG64)Maximum); Index < Last; ++Index)
+        Records[Copied++] = Pdo->Trace[Index & (XENVBD_IOTRACE_RECORDS - 1)];
+
+    *Count = Copied;
+    *Sequence = (ULONG64)Last;
+}
+
+VOID
+PdoQueryWmiOutliers(
+    __in PXENVBD_PDO                    Pdo,
+    __out PXENVBD_WMI_TARGET_OUTLIERS   Outliers
+    )
+{
+    LONG64  Last = Pdo->OutlierSequence;
+    LONG64  Index;
+
+    Outliers->TargetId      = PdoGetTargetId(Pdo);
+    Outliers->Sequence      = (ULONG64)Last;
+    Outliers->ThresholdMs   = DriverParameters.SlowThreshold;
+    Outliers->Count         = 0;
+
+    for (Index = Last - __min(Last, XENVBD_WMI_OUTLIERS); Index < Last; ++Index)
+        Outliers->Outliers[Outliers->Count++] =
+                Pdo->Outliers[Index & (XENVBD_WMI_OUTLIERS - 1)];
+}
 
-    Pdo->BlkOpRead = Pdo->BlkOpWrite = 0;
-    Pdo->BlkOpIndirectRead = Pdo->BlkOpIndirectWrite = 0;
-    Pdo->BlkOpBarrier = Pdo->BlkOpDiscard = 0;
-    Pdo->FailedMaps = Pdo->FailedBounces = Pdo->FailedGrants = 0;
-    Pdo->SegsGranted = Pdo->SegsBounced = 0;
+static FORCEINLINE ULONG64
+__PdoPerSecond(
+    __in ULONG64                 Delta,
+    __in ULONG64                 Us
+    )
+{
+    return (Us == 0) ? 0 : (Delta * 1000000ull) / Us;
+}
+
+VOID
+PdoPublishStats(
+    __in PXENVBD_PDO                Pdo
+    )
+{
+    PXENVBD_PUBLISHED   Published = &Pdo->Published;
+    XENVBD_PDO_STATS    Total;
+    XENVBD_HISTOGRAM    Device;
+    XENVBD_HISTOGRAM    Window;
+    ULONG64             Now;
+    ULONG64             Us;
+    ULONG64             Srbs;
+    ULONG64             Granted;
+    ULONG64             Bounced;
+    ULONG               Op;
+    ULONG               Size;
+    CHAR                Record[256];
+    NTSTATUS            Status;
+
+    Now = HistogramNow();
+    __PdoSumStats(Pdo, &Total);
+    Srbs = Total.CompletedSrbs;     // iops is completions, not starts
+
+    RtlZeroMemory(&Device, sizeof(Device));
+    for (Op = 0; Op < LatencyOps; ++Op)
+        for (Size = 0; Size < LatencySizes; ++Size)
+            HistogramMerge(&Device, &Pdo->Latency[Op][Size].Device);
+
+    if (Published->Time == 0 || Now <= Published->Time)
+        goto snapshot;  // first sample, nothing to compare against
+
+    Us = HistogramTicksToUs(Now - Published->Time);
+    HistogramDelta(&Window, &Device, &Published->Device);
+    Granted = Total.SegsGranted - Published->SegsGranted;
+    Bounced = Total.SegsBounced - Published->SegsBounced;
+
+    (VOID) RtlStringCbPrintfA(Record, sizeof(Record),
+                              "iops=%llu read_bps=%llu write_bps=%llu inflight=%u "
+                              "p50_us=%llu p99_us=%llu bounce_pct=%llu",
+                              __PdoPerSecond(Srbs - Published->Srbs, Us),
+                              __PdoPerSecond(Total.BytesRead - Published->BytesRead, Us),
+                              __PdoPerSecond(Total.BytesWritten - Published->BytesWritten, Us),
+                              QueueCount(&Pdo->PreparedReqs) + QueueCount(&Pdo->SubmittedReqs),
+                              HistogramPercentile(&Window, 50),
+                              HistogramPercentile(&Window, 99),
+                              (Granted + Bounced) ? (Bounced * 100) / (Granted + Bounced) : 0);
+
+    Status = FrontendWriteStats(Pdo->Frontend, "stats", Record);
+    if (!NT_SUCCESS(Status))
+        Trace("Target[%d] : stats not published (%08x)\n",
+              PdoGetTargetId(Pdo), Status);
+
+    if ((ULONG64)Pdo->OutlierSequence != Published->Outliers) {
+        LONG64          Last = Pdo->OutlierSequence - 1;
+        PXENVBD_OUTLIER Outlier = &Pdo->Outliers[Last & (XENVBD_WMI_OUTLIERS - 1)];
+
+        (VOID) RtlStringCbPrintfA(Record, sizeof(Record),
+                                  "count=%lld tag=%x op=%u lba=%llu len=%u segs=%u bounced=%u "
+                                  "indirect=%u ring=%u backend=%u queue_us=%llu device_us=%llu",
+                                  Last + 1,
+                                  Outlier->Tag,
+                                  Outlier->Operation,
+                                  Outlier->Lba,
+                                  Outlier->Length,
+                                  Outlier->Segments,
+                                  Outlier->Bounced,
+                                  Outlier->Indirect,
+                                  Outlier->RingIndex,
+                                  Outlier->BackendDomain,
+                                  Outlier->QueueUs,
+                                  Outlier->DeviceUs);
+
+        (VOID) FrontendWriteStats(Pdo->Frontend, "slow", Record);
+    }
+
+snapshot:
+    Published->Time         = Now;
+    Published->Srbs         = Srbs;
+    Published->BytesRead    = Total.BytesRead;
+    Published->BytesWritten = Total.BytesWritten;
+    Published->SegsGranted  = Total.SegsGranted;
+    Published->SegsBounced  = Total.SegsBounced;
+    Published->Outliers     = (ULONG64)Pdo->OutlierSequence;
+    Published->Device       = Device;
 }
 
 //=============================================================================
@@ -576,29 +1415,36 @@ PdoGetIndirect(
     NTSTATUS            status;
     PXENVBD_GRANTER     Granter = FrontendGetGranter(Pdo->Frontend);
 
+    if (!__PdoChargeMemory(Pdo, PDO_INDIRECT_MEMORY))
+        goto fail1;
+
     Indirect = __LookasideAlloc(&Pdo->IndirectList);
     if (Indirect == NULL)
-        goto fail1;
+        goto fail2;
 
     RtlZeroMemory(Indirect, sizeof(XENVBD_INDIRECT));
 
-    Indirect->Page = __AllocPages(PAGE_SIZE, &Indirect->Mdl);
+    Indirect->Page = __AllocNodePages(PAGE_SIZE,
+                                      FrontendGetPlacement(Pdo->Frontend)->Node,
+                                      &Indirect->Mdl);
     if (Indirect->Page == NULL)
-        goto fail2;
+        goto fail3;
 
     status = GranterGet(Granter,
                         MmGetMdlPfnArray(Indirect->Mdl)[0],
                         TRUE,
                         &Indirect->Grant);
     if (!NT_SUCCESS(status))
-        goto fail3;
+        goto fail4;
 
     return Indirect;
 
-fail3:
+fail4:
     __FreePages(Indirect->Page, Indirect->Mdl);
-fail2:
+fail3:
     __LookasideFree(&Pdo->IndirectList, Indirect);
+fail2:
+    __PdoUnchargeMemory(Pdo, PDO_INDIRECT_MEMORY);
 fail1:
     return NULL;
 }
@@ -618,22 +1464,35 @@ PdoPutIndirect(
 
     RtlZeroMemory(Indirect, sizeof(XENVBD_INDIRECT));
     __LookasideFree(&Pdo->IndirectList, Indirect);
+    __PdoUnchargeMemory(Pdo, PDO_INDIRECT_MEMORY);
 }
 
 static PXENVBD_SEGMENT
 PdoGetSegment(
-    IN  PXENVBD_PDO             Pdo
+    IN  PXENVBD_PDO             Pdo,
+    IN  PXENVBD_SRBEXT          SrbExt
     )
 {
     PXENVBD_SEGMENT             Segment;
 
+    if (SrbExt->SegmentsUsed < XENVBD_SRBEXT_SEGMENTS) {
+        Segment = &SrbExt->Segments[SrbExt->SegmentsUsed++];
+        goto done;
+    }
+
+    if (!__PdoChargeMemory(Pdo, sizeof(XENVBD_SEGMENT)))
+        goto fail1;
+
     Segment = __LookasideAlloc(&Pdo->SegmentList);
     if (Segment == NULL)
-        goto fail1;
+        goto fail2;
 
+done:
     RtlZeroMemory(Segment, sizeof(XENVBD_SEGMENT));
     return Segment;
 
+fail2:
+    __PdoUnchargeMemory(Pdo, sizeof(XENVBD_SEGMENT));
 fail1:
     return NULL;
 }
@@ -641,6 +1500,7 @@ fail1:
 static VOID
 PdoPutSegment(
     IN  PXENVBD_PDO             Pdo,
+    IN  PXENVBD_SRBEXT          SrbExt,
     IN  PXENVBD_SEGMENT         Segment
     )
 {
@@ -649,34 +1509,52 @@ PdoPutSegment(
     if (Segment->Grant)
         GranterPut(Granter, Segment->Grant);
 
-    if (Segment->BufferId)
+    if (Segment->BufferId) {
         BufferPut(Segment->BufferId);
+        __PdoUnchargeMemory(Pdo, PAGE_SIZE);
+    }
 
     if (Segment->Buffer)
         MmUnmapLockedPages(Segment->Buffer, &Segment->Mdl);
 
     RtlZeroMemory(Segment, sizeof(XENVBD_SEGMENT));
-    __LookasideFree(&Pdo->SegmentList, Segment);
+    if (!SrbExtOwnsSegment(SrbExt, Segment)) {
+        __LookasideFree(&Pdo->SegmentList, Segment);
+        __PdoUnchargeMemory(Pdo, sizeof(XENVBD_SEGMENT));
+    }
 }
 
 static PXENVBD_REQUEST
 PdoGetRequest(
-    IN  PXENVBD_PDO             Pdo
+    IN  PXENVBD_PDO             Pdo,
+    IN  PXENVBD_SRBEXT          SrbExt
     )
 {
     PXENVBD_REQUEST             Request;
 
+    if (SrbExt->RequestsUsed < XENVBD_SRBEXT_REQUESTS) {
+        Request = &SrbExt->Requests[SrbExt->RequestsUsed++];
+        goto done;
+    }
+
+    if (!__PdoChargeMemory(Pdo, sizeof(XENVBD_REQUEST)))
+        goto fail1;
+
     Request = __LookasideAlloc(&Pdo->RequestList);
     if (Request == NULL)
-        goto fail1;
+        goto fail2;
 
+done:
     RtlZeroMemory(Request, sizeof(XENVBD_REQUEST));
+    Request->Srb = SrbExt->Srb;
     Request->Id = (ULONG)InterlockedIncrement((PLONG)&Pdo->NextTag);
     InitializeListHead(&Request->Segments);
     InitializeListHead(&Request->Indirects);
 
     return Request;
 
+fail2:
+    __PdoUnchargeMemory(Pdo, sizeof(XENVBD_REQUEST));
 fail1:
     return NULL;
 }
@@ -687,6 +1565,7 @@ PdoPutRequest(
     IN  PXENVBD_REQUEST         Request
     )
 {
+    PXENVBD_SRBEXT  SrbExt = GetSrbExt(Request->Srb);
     PLIST_ENTRY     Entry;
 
     for (;;) {
@@ -696,7 +1575,7 @@ PdoPutRequest(
         if (Entry == &Request->Segments)
             break;
         Segment = CONTAINING_RECORD(Entry, XENVBD_SEGMENT, Entry);
-        PdoPutSegment(Pdo, Segment);
+        PdoPutSegment(Pdo, SrbExt, Segment);
     }
 
     for (;;) {
@@ -710,7 +1589,83 @@ PdoPutRequest(
     }
 
     RtlZeroMemory(Request, sizeof(XENVBD_REQUEST));
-    __LookasideFree(&Pdo->RequestList, Request);
+    if (!SrbExtOwnsRequest(SrbExt, Request)) {
+        __LookasideFree(&Pdo->RequestList, Request);
+        __PdoUnchargeMemory(Pdo, sizeof(XENVBD_REQUEST));
+    }
+}
+
+// SubmittedReqs is appended in submission order, so its head has been
+// outstanding the longest. Called with the queue lock held, every change to
+// the head updates OldestSubmitTime
+static FORCEINLINE VOID
+__PdoUpdateOldestSubmitted(
+    IN  PXENVBD_PDO             Pdo
+    )
+{
+    PXENVBD_QUEUE   Queue = &Pdo->SubmittedReqs;
+
+    Pdo->OldestSubmitTime = IsListEmpty(&Queue->List) ? 0 :
+            CONTAINING_RECORD(Queue->List.Flink, XENVBD_REQUEST, Entry)->SubmitTime;
+}
+
+static FORCEINLINE VOID
+__PdoAppendSubmitted(
+    IN  PXENVBD_PDO             Pdo,
+    IN  PXENVBD_REQUEST         Request
+    )
+{
+    KIRQL           Irql;
+    PXENVBD_QUEUE   Queue = &Pdo->SubmittedReqs;
+
+    KeAcquireSpinLock(&Queue->Lock, &Irql);
+
+    InsertTailList(&Queue->List, &Request->Entry);
+    if (++Queue->Current > Queue->Maximum)
+        Queue->Maximum = Queue->Current;
+    __PdoUpdateOldestSubmitted(Pdo);
+
+    KeReleaseSpinLock(&Queue->Lock, Irql);
+}
+
+static FORCEINLINE VOID
+__PdoRemoveSubmitted(
+    IN  PXENVBD_PDO             Pdo,
+    IN  PXENVBD_REQUEST         Request
+    )
+{
+    KIRQL           Irql;
+    PXENVBD_QUEUE   Queue = &Pdo->SubmittedReqs;
+
+    KeAcquireSpinLock(&Queue->Lock, &Irql);
+
+    RemoveEntryList(&Request->Entry);
+    --Queue->Current;
+    __PdoUpdateOldestSubmitted(Pdo);
+
+    KeReleaseSpinLock(&Queue->Lock, Irql);
+}
+
+static FORCEINLINE PLIST_ENTRY
+__PdoPopSubmitted(
+    IN  PXENVBD_PDO             Pdo
+    )
+{
+    KIRQL           Irql;
+    PLIST_ENTRY     Entry = NULL;
+    PXENVBD_QUEUE   Queue = &Pdo->SubmittedReqs;
+
+    KeAcquireSpinLock(&Queue->Lock, &Irql);
+
+    if (!IsListEmpty(&Queue->List)) {
+        Entry = RemoveHeadList(&Queue->List);
+        --Queue->Current;
+        __PdoUpdateOldestSubmitted(Pdo);
+    }
+
+    KeReleaseSpinLock(&Queue->Lock, Irql);
+
+    return Entry;
 }
 
 static FORCEINLINE PXENVBD_REQUEST
@@ -730,6 +1685,7 @@ PdoRequestFromTag(
         if (Request->Id == Tag) {
             RemoveEntryList(&Request->Entry);
             --Queue->Current;
+            __PdoUpdateOldestSubmitted(Pdo);
             KeReleaseSpinLock(&Queue->Lock, Irql);
             return Request;
         }
@@ -750,21 +1706,21 @@ __PdoIncBlkifOpCount(
     switch (Request->Operation) {
     case BLKIF_OP_READ:
         if (Request->NrSegments > BLKIF_MAX_SEGMENTS_PER_REQUEST)
-            ++Pdo->BlkOpIndirectRead;
+            ++__PdoStats(Pdo)->BlkOpIndirectRead;
         else
-            ++Pdo->BlkOpRead;
+            ++__PdoStats(Pdo)->BlkOpRead;
         break;
     case BLKIF_OP_WRITE:
         if (Request->NrSegments > BLKIF_MAX_SEGMENTS_PER_REQUEST)
-            ++Pdo->BlkOpIndirectWrite;
+            ++__PdoStats(Pdo)->BlkOpIndirectWrite;
         else
-            ++Pdo->BlkOpWrite;
+            ++__PdoStats(Pdo)->BlkOpWrite;
         break;
     case BLKIF_OP_WRITE_BARRIER:
-        ++Pdo->BlkOpBarrier;
+        ++__PdoStats(Pdo)->BlkOpBarrier;
         break;
     case BLKIF_OP_DISCARD:
-        ++Pdo->BlkOpDiscard;
+        ++__PdoStats(Pdo)->BlkOpDiscard;
         break;
     default:
         ASSERT(FALSE);
@@ -876,6 +1832,42 @@ SGListNext(
     return !((SGList->PhysAddr.QuadPart & AlignmentMask) || (SGList->PhysLen & AlignmentMask));
 }
 
+// Works out how many sectors the next segment covers. Returns FALSE if the
+// SG list is not sector aligned there and the segment must be bounced.
+// Shared by PrepareSegment and __PdoReadWriteMemory so the two walks agree
+static FORCEINLINE BOOLEAN
+SGListSegment(
+    IN OUT  PXENVBD_SG_LIST         SGList,
+    IN  ULONG                       SectorSize,
+    IN  ULONG                       SectorsLeft,
+    OUT PULONG                      FirstSector,
+    OUT PULONG                      SectorsNow
+    )
+{
+    const ULONG SectorsPerPage = __SectorsPerPage(SectorSize);
+
+    if (SGListNext(SGList, SectorSize - 1)) {
+        *FirstSector = (__Offset(SGList->PhysAddr) + SectorSize - 1) / SectorSize;
+        *SectorsNow  = __min(SectorsLeft, SectorsPerPage - *FirstSector);
+        return TRUE;
+    }
+
+    *FirstSector = 0;
+    *SectorsNow  = __min(SectorsLeft, SectorsPerPage);
+    return FALSE;
+}
+
+// A bounced segment may straddle two SG elements
+static FORCEINLINE BOOLEAN
+SGListSpansNext(
+    IN  PXENVBD_SG_LIST             SGList,
+    IN  ULONG                       SectorSize,
+    IN  ULONG                       SectorsNow
+    )
+{
+    return (SGList->PhysLen < SectorsNow * SectorSize) ? TRUE : FALSE;
+}
+
 static FORCEINLINE BOOLEAN
 MapSegmentBuffer(
     IN  PXENVBD_PDO             Pdo,
@@ -901,7 +1893,7 @@ MapSegmentBuffer(
     Mdl->ByteOffset     = __Offset(SGList->PhysAddr);
     Segment->Pfn[0]     = __Phys2Pfn(SGList->PhysAddr);
 
-    if (SGList->PhysLen < SectorsNow * SectorSize) {
+    if (SGListSpansNext(SGList, SectorSize, SectorsNow)) {
         SGListGet(SGList);
         Mdl->Size       += sizeof(PFN_NUMBER);
         Mdl->ByteCount  = Mdl->ByteCount + SGList->PhysLen;
@@ -961,16 +1953,18 @@ PrepareSegment(
 {
     PFN_NUMBER      Pfn;
     NTSTATUS        Status;
+    BOOLEAN         Success;
+    ULONG           FirstSector;
     PXENVBD_GRANTER Granter = FrontendGetGranter(Pdo->Frontend);
     const ULONG     SectorSize = PdoSectorSize(Pdo);
-    const ULONG     SectorsPerPage = __SectorsPerPage(SectorSize);
 
-    if (SGListNext(SGList, SectorSize - 1)) {
-        ++Pdo->SegsGranted;
-        // get first sector, last sector and count
-        Segment->FirstSector    = (UCHAR)((__Offset(SGList->PhysAddr) + SectorSize - 1) / SectorSize);
-        *SectorsNow             = __min(SectorsLeft, SectorsPerPage - Segment->FirstSector);
-        Segment->LastSector     = (UCHAR)(Segment->FirstSector + *SectorsNow - 1);
+    // get first sector, last sector and count
+    PROFILE(ProfileSegmentWalk,
+            Success = SGListSegment(SGList, SectorSize, SectorsLeft, &FirstSector, SectorsNow));
+    Segment->FirstSector    = (UCHAR)FirstSector;
+    Segment->LastSector     = (UCHAR)(FirstSector + *SectorsNow - 1);
+    if (Success) {
+        ++__PdoStats(Pdo)->SegsGranted;
         Segment->BufferId       = NULL; // granted, ensure its null
         Segment->Buffer         = NULL; // granted, ensure its null
         Segment->Length         = 0;    // granted, ensure its 0
@@ -979,36 +1973,47 @@ PrepareSegment(
         ASSERT3U((SGList->PhysLen / SectorSize), ==, *SectorsNow);
         ASSERT3U((SGList->PhysLen & (SectorSize - 1)), ==, 0);
     } else {
-        ++Pdo->SegsBounced;
-        // get first sector, last sector and count
-        Segment->FirstSector    = 0;
-        *SectorsNow             = __min(SectorsLeft, SectorsPerPage);
-        Segment->LastSector     = (UCHAR)(*SectorsNow - 1);
+        ++__PdoStats(Pdo)->SegsBounced;
 
         // map SGList to Virtual Address. Populates Segment->Buffer and Segment->Length
-        if (!MapSegmentBuffer(Pdo, Segment, SGList, SectorSize, *SectorsNow)) {
-            ++Pdo->FailedMaps;
+        PROFILE(ProfileMap,
+                Success = MapSegmentBuffer(Pdo, Segment, SGList, SectorSize, *SectorsNow));
+        if (!Success) {
+            ++__PdoStats(Pdo)->FailedMaps;
             goto fail1;
         }
 
-        // get a buffer
-        if (!BufferGet(Segment, &Segment->BufferId, &Pfn)) {
-            ++Pdo->FailedBounces;
+        // get a buffer, charged to the target's memory budget
+        Success = __PdoChargeMemory(Pdo, PAGE_SIZE);
+        if (Success) {
+            PROFILE(ProfileBounce,
+                    Success = BufferGet(Segment,
+                                        FrontendGetPlacement(Pdo->Frontend)->Node,
+                                        &Segment->BufferId,
+                                        &Pfn));
+            if (!Success)
+                __PdoUnchargeMemory(Pdo, PAGE_SIZE);
+        }
+        if (!Success) {
+            ++__PdoStats(Pdo)->FailedBounces;
             goto fail2;
         }
 
         // copy contents in
         if (ReadOnly) { // Operation == BLKIF_OP_WRITE
-            BufferCopyIn(Segment->BufferId, Segment->Buffer, Segment->Length);
+            PROFILE(ProfileBounce,
+                    BufferCopyIn(Segment->BufferId, Segment->Buffer, Segment->Length));
         }
     }
 
     // Grant segment's page
-    Status = GranterGet(Granter, Pfn, ReadOnly, &Segment->Grant);
+    PROFILE(ProfileGrant,
+            Status = GranterGet(Granter, Pfn, ReadOnly, &Segment->Grant));
     if (!NT_SUCCESS(Status)) {
-        ++Pdo->FailedGrants;
+        ++__PdoStats(Pdo)->FailedGrants;
         goto fail3;
     }
+    Segment->GrantPfn = Pfn;
 
     return TRUE;
 
@@ -1045,7 +2050,7 @@ PrepareBlkifReadWrite(
         PXENVBD_SEGMENT Segment;
         ULONG           SectorsNow;
 
-        Segment = PdoGetSegment(Pdo);
+        Segment = PdoGetSegment(Pdo, GetSrbExt(Request->Srb));
         if (Segment == NULL)
             goto fail1;
 
@@ -1120,46 +2125,178 @@ UseIndirect(
     return MaxIndirectSegs;
 }
 
-static FORCEINLINE ULONG
+static FORCEINLINE VOID
 PdoQueueRequestList(
+    IN  PXENVBD_PDO     Pdo,
+    IN  PXENVBD_SRBEXT  SrbExt,
+    IN  PLIST_ENTRY     List
+    )
+{
+    PLIST_ENTRY         Entry;
+    LONG                Count = 0;
+
+    // requests can be submitted (and completed) by the DPC as soon as they
+    // are on PreparedReqs, so the SRB's count must be complete beforehand
+    for (Entry = List->Flink; Entry != List; Entry = Entry->Flink)
+        ++Count;
+    InterlockedExchange(&SrbExt->Count, Count);
+
+    EtwSrbPrepared(PdoGetTargetId(Pdo), SrbExt, List);
+
+    for (;;) {
+        PXENVBD_REQUEST Request;
+
+        Entry = RemoveHeadList(List);
+        if (Entry == List)
+            break;
+
+        Request = CONTAINING_RECORD(Entry, XENVBD_REQUEST, Entry);
+        __PdoIncBlkifOpCount(Pdo, Request);
+        PROFILE(ProfileQueue,
+                QueueAppend(&Pdo->PreparedReqs, &Request->Entry));
+    }
+}
+
+static FORCEINLINE VOID
+PdoCancelRequestList(
     IN  PXENVBD_PDO     Pdo,
     IN  PLIST_ENTRY     List
     )
 {
-    ULONG               Count = 0;
     for (;;) {
         PXENVBD_REQUEST Request;
         PLIST_ENTRY     Entry;
 
-        Entry = RemoveHeadList(List);
-        if (Entry == List)
-            break;
+        Entry = RemoveHeadList(List);
+        if (Entry == List)
+            break;
+
+        Request = CONTAINING_RECORD(Entry, XENVBD_REQUEST, Entry);
+        PdoPutRequest(Pdo, Request);
+    }
+}
+
+#if defined(XENVBD_PROFILE)
+
+static XENVBD_SG_SHAPE
+__PdoSgShape(
+    IN  PXENVBD_PDO                 Pdo,
+    IN  PSTOR_SCATTER_GATHER_LIST   SGList
+    )
+{
+    const ULONG SectorMask = PdoSectorSize(Pdo) - 1;
+    BOOLEAN     PageAligned = TRUE;
+    BOOLEAN     Fragmented = FALSE;
+    ULONG       Index;
+
+    for (Index = 0; Index < SGList->NumberOfElements; ++Index) {
+        PSTOR_SCATTER_GATHER_ELEMENT    Element = &SGList->List[Index];
+        ULONG                           Offset = __Offset(Element->PhysicalAddress);
+
+        if ((Offset & SectorMask) || (Element->Length & SectorMask))
+            return SgShapeMisaligned;
+        if (Offset)
+            PageAligned = FALSE;
+
+        // only the last element may end part way through a page
+        if (Index + 1 < SGList->NumberOfElements &&
+            ((Offset + Element->Length) & (PAGE_SIZE - 1)))
+            Fragmented = TRUE;
+    }
+
+    if (!PageAligned)
+        return SgShapeSectorOffset;
+    if (Fragmented)
+        return SgShapeFragmented;
+    return SgShapeAligned;
+}
+
+static VOID
+__PdoRecordSgStats(
+    IN  PXENVBD_PDO                 Pdo,
+    IN  PSTOR_SCATTER_GATHER_LIST   SGList,
+    IN  PLIST_ENTRY                 List,
+    IN  ULONG64                     Cycles
+    )
+{
+    PXENVBD_SG_STATS    Stats = &__PdoCpu(Pdo)->SgStats[__PdoSgShape(Pdo, SGList)];
+    PLIST_ENTRY         Entry;
+
+    for (Entry = List->Flink; Entry != List; Entry = Entry->Flink) {
+        PXENVBD_REQUEST Request = CONTAINING_RECORD(Entry, XENVBD_REQUEST, Entry);
+        PLIST_ENTRY     SegEntry;
+
+        for (SegEntry = Request->Segments.Flink;
+             SegEntry != &Request->Segments;
+             SegEntry = SegEntry->Flink) {
+            PXENVBD_SEGMENT Segment = CONTAINING_RECORD(SegEntry, XENVBD_SEGMENT, Entry);
 
-        ++Count;
-        Request = CONTAINING_RECORD(Entry, XENVBD_REQUEST, Entry);
-        __PdoIncBlkifOpCount(Pdo, Request);
-        QueueAppend(&Pdo->PreparedReqs, &Request->Entry);
+            ++Stats->Segments;
+            if (Segment->BufferId != NULL)
+                ++Stats->Bounced;
+        }
     }
-    return Count;
+
+    ++Stats->Srbs;
+    Stats->Cycles += Cycles;
 }
 
-static FORCEINLINE VOID
-PdoCancelRequestList(
-    IN  PXENVBD_PDO     Pdo,
-    IN  PLIST_ENTRY     List
+#endif  // XENVBD_PROFILE
+
+// Walks a copy of the SG list the way PrepareReadWrite will, and returns the
+// memory budget the SRB's requests, segments, bounce and indirect pages need
+static LONG64
+__PdoReadWriteMemory(
+    __in PXENVBD_PDO             Pdo,
+    __in PSCSI_REQUEST_BLOCK     Srb
     )
 {
-    for (;;) {
-        PXENVBD_REQUEST Request;
-        PLIST_ENTRY     Entry;
+    const ULONG     SectorSize = PdoSectorSize(Pdo);
+    ULONG           SectorsLeft = Cdb_TransferBlock(Srb);
+    XENVBD_SG_LIST  SGList;
+    ULONG           Requests = 0;
+    ULONG           Segments = 0;
+    ULONG           Bounced = 0;
+    ULONG           Indirects = 0;
+    LONG64          Bytes = 0;
 
-        Entry = RemoveHeadList(List);
-        if (Entry == List)
-            break;
+    RtlZeroMemory(&SGList, sizeof(SGList));
+    SGList.SGList = StorPortGetScatterGatherList(PdoGetFdo(Pdo), Srb);
 
-        Request = CONTAINING_RECORD(Entry, XENVBD_REQUEST, Entry);
-        PdoPutRequest(Pdo, Request);
+    while (SectorsLeft > 0) {
+        const ULONG MaxSegments = UseIndirect(Pdo, SectorsLeft);
+        ULONG       NrSegments = 0;
+
+        while (NrSegments < MaxSegments && SectorsLeft > 0) {
+            ULONG   FirstSector;
+            ULONG   SectorsNow;
+
+            if (!SGListSegment(&SGList, SectorSize, SectorsLeft, &FirstSector, &SectorsNow)) {
+                if (SGListSpansNext(&SGList, SectorSize, SectorsNow))
+                    SGListGet(&SGList);     // as MapSegmentBuffer
+                ++Bounced;
+            }
+
+            ++NrSegments;
+            SectorsLeft -= SectorsNow;
+        }
+
+        ++Requests;
+        Segments += NrSegments;
+        if (MaxSegments > BLKIF_MAX_SEGMENTS_PER_REQUEST)
+            Indirects += (NrSegments + XENVBD_MAX_SEGMENTS_PER_PAGE - 1) /
+                         XENVBD_MAX_SEGMENTS_PER_PAGE;
     }
+
+    // the first requests and segments come from the SRB extension
+    if (Requests > XENVBD_SRBEXT_REQUESTS)
+        Bytes += (Requests - XENVBD_SRBEXT_REQUESTS) * sizeof(XENVBD_REQUEST);
+    if (Segments > XENVBD_SRBEXT_SEGMENTS)
+        Bytes += (Segments - XENVBD_SRBEXT_SEGMENTS) * sizeof(XENVBD_SEGMENT);
+    Bytes += (LONG64)Bounced * PAGE_SIZE;
+    Bytes += (LONG64)Indirects * PDO_INDIRECT_MEMORY;
+
+    return Bytes;
 }
 
 __checkReturn
@@ -1174,9 +2311,14 @@ PrepareReadWrite(
     ULONG           SectorsLeft = Cdb_TransferBlock(Srb);
     LIST_ENTRY      List;
     XENVBD_SG_LIST  SGList;
+#if defined(XENVBD_PROFILE)
+    ULONG64         Cycles;
 
+    Cycles = ReadTimeStampCounter();
+#endif
     InitializeListHead(&List);
     SrbExt->Count = 0;
+    SrbExtResetArena(SrbExt);
     Srb->SrbStatus = SRB_STATUS_PENDING;
 
     RtlZeroMemory(&SGList, sizeof(SGList));
@@ -1187,7 +2329,7 @@ PrepareReadWrite(
         ULONG           SectorsDone = 0;
         PXENVBD_REQUEST Request;
 
-        Request = PdoGetRequest(Pdo);
+        Request = PdoGetRequest(Pdo, SrbExt);
         if (Request == NULL) 
             goto fail1;
         InsertTailList(&List, &Request->Entry);
@@ -1213,7 +2355,10 @@ PrepareReadWrite(
         SectorStart += SectorsDone;
     }
 
-    SrbExt->Count = PdoQueueRequestList(Pdo, &List);
+#if defined(XENVBD_PROFILE)
+    __PdoRecordSgStats(Pdo, SGList.SGList, &List, ReadTimeStampCounter() - Cycles);
+#endif
+    PdoQueueRequestList(Pdo, SrbExt, &List);
     return TRUE;
 
 fail3:
@@ -1236,9 +2381,10 @@ PrepareSyncCache(
     
     InitializeListHead(&List);
     SrbExt->Count = 0;
+    SrbExtResetArena(SrbExt);
     Srb->SrbStatus = SRB_STATUS_PENDING;
 
-    Request = PdoGetRequest(Pdo);
+    Request = PdoGetRequest(Pdo, SrbExt);
     if (Request == NULL)
         goto fail1;
     InsertTailList(&List, &Request->Entry);
@@ -1247,7 +2393,7 @@ PrepareSyncCache(
     Request->Operation  = BLKIF_OP_WRITE_BARRIER;
     Request->FirstSector = Cdb_LogicalBlock(Srb);
 
-    SrbExt->Count = PdoQueueRequestList(Pdo, &List);
+    PdoQueueRequestList(Pdo, SrbExt, &List);
     return TRUE;
 
 fail1:
@@ -1270,13 +2416,14 @@ PrepareUnmap(
 
     InitializeListHead(&List);
     SrbExt->Count = 0;
+    SrbExtResetArena(SrbExt);
     Srb->SrbStatus = SRB_STATUS_PENDING;
 
     for (Index = 0; Index < Count; ++Index) {
         PUNMAP_BLOCK_DESCRIPTOR Descr = &Unmap->Descriptors[Index];
         PXENVBD_REQUEST         Request;
 
-        Request = PdoGetRequest(Pdo);
+        Request = PdoGetRequest(Pdo, SrbExt);
         if (Request == NULL)
             goto fail1;
         InsertTailList(&List, &Request->Entry);
@@ -1288,7 +2435,7 @@ PrepareUnmap(
         Request->Flags          = 0;
     }
 
-    SrbExt->Count = PdoQueueRequestList(Pdo, &List);
+    PdoQueueRequestList(Pdo, SrbExt, &List);
     return TRUE;
 
 fail1:
@@ -1298,6 +2445,11 @@ fail1:
 
 //=============================================================================
 // Queue-Related
+#define PDO_DRAIN_INTERVAL_MIN  1000        // us
+#define PDO_DRAIN_INTERVAL_MAX  1000000     // us
+#define PDO_DRAIN_WARNING       10000000    // us
+#define PDO_DRAIN_TIMEOUT       180000000   // us
+
 static FORCEINLINE VOID
 __PdoPauseDataPath(
     __in PXENVBD_PDO             Pdo,
@@ -1306,7 +2458,12 @@ __PdoPauseDataPath(
 {
     KIRQL               Irql;
     ULONG               Requests;
+    ULONG               Left;
     ULONG               Count = 0;
+    ULONG64             Start;
+    ULONG64             Waited;
+    ULONG64             NextWarning;
+    ULONG               Interval;
     PXENVBD_NOTIFIER    Notifier = FrontendGetNotifier(Pdo->Frontend);
     PXENVBD_BLOCKRING   BlockRing = FrontendGetBlockRing(Pdo->Frontend);
 
@@ -1314,24 +2471,91 @@ __PdoPauseDataPath(
     ++Pdo->Paused;
     KeReleaseSpinLock(&Pdo->Lock, Irql);
 
-    Requests = QueueCount(&Pdo->SubmittedReqs);
+    // submitters check Paused under SubmitLock, so once it has been taken
+    // here nothing more can reach SubmittedReqs
+    KeAcquireSpinLock(&Pdo->SubmitLock, &Irql);
+    KeReleaseSpinLock(&Pdo->SubmitLock, Irql);
+
+    Pdo->Draining = TRUE;
     KeMemoryBarrier();
 
+    Requests = QueueCount(&Pdo->SubmittedReqs);
+    Start = HistogramNow();
+
     Verbose("Target[%d] : Waiting for %d Submitted requests\n", PdoGetTargetId(Pdo), Requests);
 
-    // poll ring and send event channel notification every 1ms (for up to 3 minutes)
-    while (QueueCount(&Pdo->SubmittedReqs)) {
-        if (Timeout && Count > 180000)
+    // Completions set DrainEvent when SubmittedReqs empties, so below
+    // DISPATCH_LEVEL this sleeps rather than spins. Polling the ring and
+    // kicking the backend is only a fallback, backed off from 1ms to 1s
+    // for as long as nothing completes, and back to 1ms when something
+    // does. At DISPATCH_LEVEL nothing can be waited on, so that still
+    // stalls 1ms at a time (resets are drained from the FDO reset thread).
+    Interval = PDO_DRAIN_INTERVAL_MIN;
+    NextWarning = PDO_DRAIN_WARNING;
+    Left = Requests;
+    for (;;) {
+        LARGE_INTEGER   Wait;
+        NTSTATUS        Status;
+
+        // DrainEvent is a NotificationEvent and stays signalled once set.
+        // Clear it before looking at the count, so a completion that
+        // empties the queue after the check still wakes the wait below
+        KeClearEvent(&Pdo->DrainEvent);
+        KeMemoryBarrier();
+
+        if (QueueCount(&Pdo->SubmittedReqs) == 0)
+            break;
+
+        Waited = HistogramTicksToUs(HistogramNow() - Start);
+        if (Timeout && Waited > PDO_DRAIN_TIMEOUT) {
+            ++Pdo->DrainTimeouts;
             break;
+        }
+        if (Waited >= NextWarning) {
+            Warning("Target[%d] : %u/%u Submitted requests left after %llums\n",
+                    PdoGetTargetId(Pdo), QueueCount(&Pdo->SubmittedReqs),
+                    Requests, Waited / 1000);
+            NextWarning += PDO_DRAIN_WARNING;
+        }
+
         KeRaiseIrql(DISPATCH_LEVEL, &Irql);
         BlockRingPoll(BlockRing);
         KeLowerIrql(Irql);
         NotifierSend(Notifier);         // let backend know it needs to do some work
-        StorPortStallExecution(1000);   // 1000 micro-seconds
         ++Count;
+
+        if (KeGetCurrentIrql() >= DISPATCH_LEVEL) {
+            StorPortStallExecution(PDO_DRAIN_INTERVAL_MIN);
+            continue;
+        }
+
+        Wait.QuadPart = TIME_RELATIVE(TIME_US((LONGLONG)Interval));
+        Status = KeWaitForSingleObject(&Pdo->DrainEvent, Executive,
+                                       KernelMode, FALSE, &Wait);
+        if (Status == STATUS_SUCCESS)
+            continue;
+
+        // the backend is still making progress, keep polling at the start
+        if (QueueCount(&Pdo->SubmittedReqs) < Left) {
+            Left = QueueCount(&Pdo->SubmittedReqs);
+            Interval = PDO_DRAIN_INTERVAL_MIN;
+            continue;
+        }
+
+        // nothing completed, poll less often
+        if (Interval < PDO_DRAIN_INTERVAL_MAX) {
+            Interval *= 2;
+            ++Pdo->DrainEscalations;
+        }
     }
 
-    Verbose("Target[%d] : %u/%u Submitted requests left (%u iterrations)\n",
+    Pdo->Draining = FALSE;
+
+    Waited = HistogramNow();
+    HistogramAdd(&Pdo->DrainWait, HistogramTicksToUs(Waited - Start));
+    Start = Waited;
+
+    Verbose("Target[%d] : %u/%u Submitted requests left (%u polls)\n",
             PdoGetTargetId(Pdo), QueueCount(&Pdo->SubmittedReqs), Requests, Count);
 
     // Abort Fresh SRBs
@@ -1368,6 +2592,8 @@ __PdoPauseDataPath(
             FdoCompleteSrb(PdoGetFdo(Pdo), SrbExt->Srb);
         }
     }
+
+    HistogramAdd(&Pdo->DrainAbort, HistogramTicksToUs(HistogramNow() - Start));
 }
 
 static FORCEINLINE VOID
@@ -1382,48 +2608,169 @@ __PdoUnpauseDataPath(
     KeReleaseSpinLock(&Pdo->Lock, Irql);
 }
 
-static FORCEINLINE BOOLEAN
-PdoPrepareFresh(
-    IN  PXENVBD_PDO         Pdo
+static LONG64
+__PdoSrbMemory(
+    IN  PXENVBD_PDO         Pdo,
+    IN  PSCSI_REQUEST_BLOCK Srb
     )
 {
-    PXENVBD_SRBEXT  SrbExt;
-    PLIST_ENTRY     Entry;
+    PUNMAP_LIST_HEADER  Unmap;
+    ULONG               Count;
 
-    Entry = QueuePop(&Pdo->FreshSrbs);
-    if (Entry == NULL)
-        return FALSE;   // fresh queue is empty
+    // nothing is ever refused without a budget, skip the SG list walk
+    if (DriverParameters.MemoryBudget == 0)
+        return 0;
 
-    SrbExt = CONTAINING_RECORD(Entry, XENVBD_SRBEXT, Entry);
+    switch (Cdb_OperationEx(Srb)) {
+    case SCSIOP_READ:
+    case SCSIOP_WRITE:
+        return __PdoReadWriteMemory(Pdo, Srb);
+    case SCSIOP_UNMAP:
+        Unmap = Srb->DataBuffer;
+        Count = _byteswap_ushort(*(PUSHORT)Unmap->BlockDescrDataLength) / sizeof(UNMAP_BLOCK_DESCRIPTOR);
+        if (Count <= XENVBD_SRBEXT_REQUESTS)
+            return 0;
+        return (Count - XENVBD_SRBEXT_REQUESTS) * sizeof(XENVBD_REQUEST);
+    default:
+        return 0;
+    }
+}
+
+static FORCEINLINE BOOLEAN
+__PdoPrepareSrb(
+    IN  PXENVBD_PDO         Pdo,
+    IN  PSCSI_REQUEST_BLOCK Srb
+    )
+{
+    LONG64  Reserve;
+    BOOLEAN Success;
+
+    // reserve everything the SRB takes from the memory budget before any of
+    // it is built, so it either fits in full or is left untouched
+    Reserve = __PdoSrbMemory(Pdo, Srb);
+    if (!__PdoReserveMemory(Pdo, Reserve)) {
+        // wait first and then try once more, so memory released after the
+        // refusal but before this target was waiting still wakes it
+        FdoWaitForMemory(PdoGetFdo(Pdo), PdoGetTargetId(Pdo));
+        if (!__PdoReserveMemory(Pdo, Reserve))
+            return FALSE;
+    }
 
-    switch (Cdb_OperationEx(SrbExt->Srb)) {
+    switch (Cdb_OperationEx(Srb)) {
     case SCSIOP_READ:
     case SCSIOP_WRITE:
-        if (PrepareReadWrite(Pdo, SrbExt->Srb))
-            return TRUE;    // prepared this SRB
+        Success = PrepareReadWrite(Pdo, Srb);
         break;
     case SCSIOP_SYNCHRONIZE_CACHE:
-        if (PrepareSyncCache(Pdo, SrbExt->Srb))
-            return TRUE;    // prepared this SRB
+        Success = PrepareSyncCache(Pdo, Srb);
         break;
     case SCSIOP_UNMAP:
-        if (PrepareUnmap(Pdo, SrbExt->Srb))
-            return TRUE;    // prepared this SRB
+        Success = PrepareUnmap(Pdo, Srb);
         break;
     default:
         ASSERT(FALSE);
+        Success = FALSE;
         break;
     }
+
+    __PdoUnreserveMemory(Pdo, Reserve);
+    return Success;
+}
+
+static VOID
+__PdoSetBusy(
+    IN  PXENVBD_PDO         Pdo
+    )
+{
+    LONG    Busy;
+
+    Busy = InterlockedCompareExchange(&Pdo->Busy, 1, 0);
+    if (Busy == 0)
+        ++Pdo->BusyEpisodes;
+
+    // StorPort is only held off while a completion is due, which restarts
+    // it. With nothing in flight a grant, lookaside or mapping failure may
+    // never be retried, so have the DPC try again shortly
+    if (QueueCount(&Pdo->SubmittedReqs) == 0) {
+        NotifierKickAfter(FrontendGetNotifier(Pdo->Frontend), PDO_BUSY_RETRY);
+        return;
+    }
+
+    if (Busy != 0)
+        return;
+
+    (VOID) StorPortDeviceBusy(PdoGetFdo(Pdo),
+                              0,
+                              (UCHAR)PdoGetTargetId(Pdo),
+                              0,
+                              1);
+
+    // cleared while StorPort was being told, undo it
+    if (InterlockedCompareExchange(&Pdo->Busy, 2, 1) != 1)
+        (VOID) StorPortDeviceReady(PdoGetFdo(Pdo),
+                                   0,
+                                   (UCHAR)PdoGetTargetId(Pdo),
+                                   0);
+}
+
+static FORCEINLINE VOID
+__PdoClearBusy(
+    IN  PXENVBD_PDO         Pdo
+    )
+{
+    if (Pdo->Busy == 0)
+        return;
+
+    if (InterlockedExchange(&Pdo->Busy, 0) == 2)
+        (VOID) StorPortDeviceReady(PdoGetFdo(Pdo),
+                                   0,
+                                   (UCHAR)PdoGetTargetId(Pdo),
+                                   0);
+}
+
+static FORCEINLINE BOOLEAN
+PdoPrepareFresh(
+    IN  PXENVBD_PDO         Pdo
+    )
+{
+    PXENVBD_SRBEXT  SrbExt;
+    PLIST_ENTRY     Entry;
+
+    Entry = QueuePop(&Pdo->FreshSrbs);
+    if (Entry == NULL)
+        return FALSE;   // fresh queue is empty
+
+    SrbExt = CONTAINING_RECORD(Entry, XENVBD_SRBEXT, Entry);
+
+    if (__PdoPrepareSrb(Pdo, SrbExt->Srb)) {
+        __PdoClearBusy(Pdo);
+        return TRUE;    // prepared this SRB
+    }
+
     QueueUnPop(&Pdo->FreshSrbs, &SrbExt->Entry);
+    __PdoSetBusy(Pdo);
     return FALSE;       // prepare failed
 }
 
+static FORCEINLINE VOID
+__PdoRecordBacklog(
+    __in PXENVBD_PDO             Pdo
+    )
+{
+    ULONG   Backlog = QueueCount(&Pdo->PreparedReqs);
+
+    Pdo->BacklogTotal += Backlog;
+    if (Backlog > Pdo->BacklogMaximum)
+        Pdo->BacklogMaximum = Backlog;
+}
+
 static FORCEINLINE BOOLEAN
 PdoSubmitPrepared(
     __in PXENVBD_PDO             Pdo
     )
 {
     PXENVBD_BLOCKRING   BlockRing = FrontendGetBlockRing(Pdo->Frontend);
+    ULONG64             Now = 0;
 
     for (;;) {
         PXENVBD_REQUEST Request;
@@ -1435,89 +2782,366 @@ PdoSubmitPrepared(
 
         Request = CONTAINING_RECORD(Entry, XENVBD_REQUEST, Entry);
 
-        QueueAppend(&Pdo->SubmittedReqs, &Request->Entry);
+        // one timestamp per batch, BlockRingSubmit samples with it too
+        if (Now == 0)
+            Now = HistogramNow();
+        Request->SubmitTime = Now;
+        __PdoAppendSubmitted(Pdo, Request);
         KeMemoryBarrier();
 
         if (BlockRingSubmit(BlockRing, Request))
             continue;
 
-        QueueRemove(&Pdo->SubmittedReqs, &Request->Entry);
-        QueueUnPop(&Pdo->PreparedReqs, &Request->Entry);
-        return FALSE;   // ring full
+        __PdoRemoveSubmitted(Pdo, Request);
+        QueueUnPop(&Pdo->PreparedReqs, &Request->Entry);
+        ++__PdoStats(Pdo)->RingFull;
+        __PdoRecordBacklog(Pdo);
+        return FALSE;   // ring full
+    }
+
+    return TRUE;
+}
+
+static FORCEINLINE VOID
+PdoCompleteShutdown(
+    __in PXENVBD_PDO             Pdo
+    )
+{
+    if (QueueCount(&Pdo->ShutdownSrbs) == 0)
+        return;
+
+    if (QueueCount(&Pdo->FreshSrbs) ||
+        QueueCount(&Pdo->PreparedReqs) ||
+        QueueCount(&Pdo->SubmittedReqs))
+        return;
+
+    for (;;) {
+        PXENVBD_SRBEXT  SrbExt;
+        PLIST_ENTRY     Entry = QueuePop(&Pdo->ShutdownSrbs);
+        if (Entry == NULL)
+            break;
+        SrbExt = CONTAINING_RECORD(Entry, XENVBD_SRBEXT, Entry);
+        SrbExt->Srb->SrbStatus = SRB_STATUS_SUCCESS;
+        FdoCompleteSrb(PdoGetFdo(Pdo), SrbExt->Srb);
+    }
+}
+
+VOID
+PdoSubmitRequests(
+    __in PXENVBD_PDO             Pdo
+    )
+{
+    KIRQL   Irql;
+
+    // the DPC and StartIo both submit, SubmitLock keeps
+    // them from interleaving and reordering PreparedReqs
+    KeAcquireSpinLock(&Pdo->SubmitLock, &Irql);
+
+    while (Pdo->Paused == 0) {
+        // submit all prepared requests (0 or more requests)
+        // return TRUE if submitted 0 or more requests from prepared queue
+        // return FALSE iff ring is full
+        if (!PdoSubmitPrepared(Pdo))
+            break;
+
+        // prepare a single SRB (into 1 or more requests)
+        // return TRUE if prepare succeeded
+        // return FALSE if prepare failed or fresh queue empty
+        if (!PdoPrepareFresh(Pdo))
+            break;
+    }
+
+    KeReleaseSpinLock(&Pdo->SubmitLock, Irql);
+
+    // if no requests/SRBs outstanding, complete any shutdown SRBs
+    PdoCompleteShutdown(Pdo);
+
+    // hand back credit freed by this batch of completions in one go if
+    // another target is waiting for it
+    if (FdoIsWaitingForMemory(Pdo->Fdo))
+        PdoReclaimMemory(Pdo);
+}
+
+VOID
+PdoKickRequests(
+    __in PXENVBD_PDO             Pdo
+    )
+{
+    NotifierKick(FrontendGetNotifier(Pdo->Frontend));
+}
+
+static VOID
+PdoQueueFresh(
+    __in PXENVBD_PDO             Pdo,
+    __in PXENVBD_SRBEXT          SrbExt
+    )
+{
+    PXENVBD_NOTIFIER    Notifier = FrontendGetNotifier(Pdo->Frontend);
+    PXENVBD_BLOCKRING   BlockRing = FrontendGetBlockRing(Pdo->Frontend);
+    KIRQL               Irql;
+    BOOLEAN             Locked;
+
+    // never wait behind another submitter, the DPC picks this SRB up
+    KeRaiseIrql(DISPATCH_LEVEL, &Irql);
+    Locked = KeTryToAcquireSpinLockAtDpcLevel(&Pdo->SubmitLock);
+
+    // nothing queued ahead of this SRB, not paused and the ring has room, so
+    // prepare and submit it from here rather than waiting for the DPC
+    if (!Locked ||
+        QueueCount(&Pdo->FreshSrbs) ||
+        QueueCount(&Pdo->PreparedReqs) ||
+        Pdo->Paused != 0 ||
+        !BlockRingCanSubmit(BlockRing) ||
+        !__PdoPrepareSrb(Pdo, SrbExt->Srb)) {
+        // still under SubmitLock if it was taken, so no later SRB can be
+        // submitted directly ahead of this one
+        ++__PdoStats(Pdo)->DeferredSrbs;
+        PROFILE(ProfileQueue,
+                QueueAppend(&Pdo->FreshSrbs, &SrbExt->Entry));
+        if (Locked)
+            KeReleaseSpinLockFromDpcLevel(&Pdo->SubmitLock);
+        KeLowerIrql(Irql);
+
+        NotifierKick(Notifier);
+        return;
+    }
+
+    ++__PdoStats(Pdo)->DirectSrbs;
+
+    // ring filled up part way through, DPC submits the remainder
+    if (!PdoSubmitPrepared(Pdo))
+        NotifierKick(Notifier);
+
+    KeReleaseSpinLockFromDpcLevel(&Pdo->SubmitLock);
+    KeLowerIrql(Irql);
+}
+
+static FORCEINLINE PXENVBD_LATENCY
+__PdoGetLatency(
+    IN  PXENVBD_PDO             Pdo,
+    IN  PXENVBD_REQUEST         Request
+    )
+{
+    XENVBD_LATENCY_OP   Op;
+    XENVBD_LATENCY_SIZE Size;
+    ULONG               Length = Request->Srb->DataTransferLength;
+
+    switch (Request->Operation) {
+    case BLKIF_OP_READ:
+        Op = (Request->NrSegments > BLKIF_MAX_SEGMENTS_PER_REQUEST) ?
+                LatencyIndirectRead : LatencyRead;
+        break;
+    case BLKIF_OP_WRITE:
+        Op = (Request->NrSegments > BLKIF_MAX_SEGMENTS_PER_REQUEST) ?
+                LatencyIndirectWrite : LatencyWrite;
+        break;
+    case BLKIF_OP_WRITE_BARRIER:
+        return &Pdo->Latency[LatencyBarrier][LatencyUpTo4K];
+    case BLKIF_OP_DISCARD:
+        return &Pdo->Latency[LatencyDiscard][LatencyUpTo4K];
+    default:
+        return NULL;
+    }
+
+    if (Length <= 4 * 1024)
+        Size = LatencyUpTo4K;
+    else if (Length <= 64 * 1024)
+        Size = LatencyUpTo64K;
+    else if (Length <= 512 * 1024)
+        Size = LatencyUpTo512K;
+    else
+        Size = LatencyOver512K;
+
+    return &Pdo->Latency[Op][Size];
+}
+
+static FORCEINLINE VOID
+__PdoRecordLatency(
+    IN  PXENVBD_PDO             Pdo,
+    IN  PXENVBD_REQUEST         Request,
+    IN  PXENVBD_SRBEXT          SrbExt,
+    IN  ULONG64                 Now
+    )
+{
+    PXENVBD_LATENCY Latency = __PdoGetLatency(Pdo, Request);
+
+    if (Latency == NULL || Request->SubmitTime == 0)
+        return;
+
+    if (SrbExt->StartTime != 0 && Request->SubmitTime >= SrbExt->StartTime)
+        HistogramAdd(&Latency->Queue,
+                     HistogramTicksToUs(Request->SubmitTime - SrbExt->StartTime));
+    if (Now >= Request->SubmitTime)
+        HistogramAdd(&Latency->Device,
+                     HistogramTicksToUs(Now - Request->SubmitTime));
+}
+
+// Outliers are captured at most this often before their Warning()s are
+// only counted, so a backend that stalls does not flood the log
+#define PDO_OUTLIER_WARNING_INTERVAL    1000000     // us
+
+static DECLSPEC_NOINLINE VOID
+__PdoCaptureOutlier(
+    IN  PXENVBD_PDO             Pdo,
+    IN  PXENVBD_REQUEST         Request,
+    IN  PXENVBD_SRBEXT          SrbExt,
+    IN  ULONG64                 Now,
+    IN  BOOLEAN                 Outstanding
+    )
+{
+    PXENVBD_OUTLIER Outlier;
+    PLIST_ENTRY     Entry;
+    LONG64          Index;
+    USHORT          Bounced = 0;
+
+    if (Request->Operation == BLKIF_OP_READ ||
+        Request->Operation == BLKIF_OP_WRITE) {
+        for (Entry = Request->Segments.Flink;
+             Entry != &Request->Segments;
+             Entry = Entry->Flink) {
+            PXENVBD_SEGMENT Segment = CONTAINING_RECORD(Entry, XENVBD_SEGMENT, Entry);
+            if (Segment->BufferId != NULL)
+                ++Bounced;
+        }
+    }
+
+    Index = InterlockedIncrement64(&Pdo->OutlierSequence) - 1;
+    Outlier = &Pdo->Outliers[Index & (XENVBD_WMI_OUTLIERS - 1)];
+
+    Outlier->Lba            = Request->FirstSector;
+    Outlier->StartUs        = HistogramTicksToUs(SrbExt->StartTime);
+    Outlier->QueueUs        = (Request->SubmitTime > SrbExt->StartTime) ?
+                                HistogramTicksToUs(Request->SubmitTime - SrbExt->StartTime) : 0;
+    Outlier->DeviceUs       = (Now > Request->SubmitTime) ?
+                                HistogramTicksToUs(Now - Request->SubmitTime) : 0;
+    Outlier->Tag            = Request->Id;
+    Outlier->Length         = SrbExt->Srb->DataTransferLength;
+    Outlier->RingIndex      = Request->RingIndex;
+    Outlier->Segments       = Request->NrSegments;
+    Outlier->Bounced        = Bounced;
+    Outlier->BackendDomain  = FrontendGetBackendDomain(Pdo->Frontend);
+    Outlier->Operation      = Request->Operation;
+    Outlier->Indirect       = (Request->NrSegments > BLKIF_MAX_SEGMENTS_PER_REQUEST);
+    Outlier->Outstanding    = Outstanding;
+
+    if (Pdo->OutlierWarned != 0 &&
+        HistogramTicksToUs(Now - Pdo->OutlierWarned) < PDO_OUTLIER_WARNING_INTERVAL) {
+        ++Pdo->OutlierQuiet;
+        return;
     }
 
-    return TRUE;
+    Warning("Target[%d] : slow %s (Tag %x) %lluus queued %lluus on device%s (%u not logged)\n",
+            PdoGetTargetId(Pdo),
+            BlkifOperationName(Request->Operation),
+            Request->Id,
+            Outlier->QueueUs,
+            Outlier->DeviceUs,
+            Outstanding ? " so far" : "",
+            Pdo->OutlierQuiet);
+    Pdo->OutlierWarned = Now;
+    Pdo->OutlierQuiet = 0;
 }
 
 static FORCEINLINE VOID
-PdoCompleteShutdown(
-    __in PXENVBD_PDO             Pdo
+__PdoCheckOutlier(
+    IN  PXENVBD_PDO             Pdo,
+    IN  PXENVBD_REQUEST         Request,
+    IN  PXENVBD_SRBEXT          SrbExt,
+    IN  ULONG64                 Now
     )
 {
-    if (QueueCount(&Pdo->ShutdownSrbs) == 0)
+    if (DriverParameters.SlowThreshold == 0 || SrbExt->StartTime == 0)
         return;
 
-    if (QueueCount(&Pdo->FreshSrbs) ||
-        QueueCount(&Pdo->PreparedReqs) ||
-        QueueCount(&Pdo->SubmittedReqs))
+    // already captured by PdoScanOutliers while it was stuck
+    if (Request->Outlier)
         return;
 
-    for (;;) {
-        PXENVBD_SRBEXT  SrbExt;
-        PLIST_ENTRY     Entry = QueuePop(&Pdo->ShutdownSrbs);
-        if (Entry == NULL)
-            break;
-        SrbExt = CONTAINING_RECORD(Entry, XENVBD_SRBEXT, Entry);
-        SrbExt->Srb->SrbStatus = SRB_STATUS_SUCCESS;
-        FdoCompleteSrb(PdoGetFdo(Pdo), SrbExt->Srb);
-    }
-}
+    if (Now <= SrbExt->StartTime ||
+        HistogramTicksToUs(Now - SrbExt->StartTime) <
+                (ULONG64)DriverParameters.SlowThreshold * 1000)
+        return;
 
-static FORCEINLINE PCHAR
-BlkifOperationName(
-    IN  UCHAR                   Operation
-    )
-{
-    switch (Operation) {
-    case BLKIF_OP_READ:             return "READ";
-    case BLKIF_OP_WRITE:            return "WRITE";
-    case BLKIF_OP_WRITE_BARRIER:    return "WRITE_BARRIER";
-    case BLKIF_OP_FLUSH_DISKCACHE:  return "FLUSH_DISKCACHE";
-    case BLKIF_OP_RESERVED_1:       return "RESERVED_1";
-    case BLKIF_OP_DISCARD:          return "DISCARD";
-    case BLKIF_OP_INDIRECT:         return "INDIRECT";
-    default:                        return "<unknown>";
-    }
+    __PdoCaptureOutlier(Pdo, Request, SrbExt, Now, FALSE);
 }
 
+// A request the backend never answers would not be captured on completion,
+// so the stats thread also looks for submitted requests that are already
+// past the threshold
 VOID
-PdoSubmitRequests(
+PdoScanOutliers(
     __in PXENVBD_PDO             Pdo
     )
 {
-    for (;;) {
-        // submit all prepared requests (0 or more requests)
-        // return TRUE if submitted 0 or more requests from prepared queue
-        // return FALSE iff ring is full
-        if (!PdoSubmitPrepared(Pdo))
-            break;
+    PXENVBD_QUEUE   Queue = &Pdo->SubmittedReqs;
+    PLIST_ENTRY     Entry;
+    ULONG64         Now;
+    KIRQL           Irql;
 
-        // prepare a single SRB (into 1 or more requests)
-        // return TRUE if prepare succeeded
-        // return FALSE if prepare failed or fresh queue empty
-        if (!PdoPrepareFresh(Pdo))
+    if (DriverParameters.SlowThreshold == 0)
+        return;
+
+    Now = HistogramNow();
+
+    KeAcquireSpinLock(&Queue->Lock, &Irql);
+    for (Entry = Queue->List.Flink; Entry != &Queue->List; Entry = Entry->Flink) {
+        PXENVBD_REQUEST Request = CONTAINING_RECORD(Entry, XENVBD_REQUEST, Entry);
+        PXENVBD_SRBEXT  SrbExt = GetSrbExt(Request->Srb);
+
+        if (SrbExt->StartTime == 0 || Request->Outlier)
+            continue;
+
+        // submitted in order, so everything after this is younger
+        if (Now <= SrbExt->StartTime ||
+            HistogramTicksToUs(Now - SrbExt->StartTime) <
+                    (ULONG64)DriverParameters.SlowThreshold * 1000)
             break;
+
+        Request->Outlier = TRUE;
+        __PdoCaptureOutlier(Pdo, Request, SrbExt, Now, TRUE);
     }
+    KeReleaseSpinLock(&Queue->Lock, Irql);
+}
 
-    // if no requests/SRBs outstanding, complete any shutdown SRBs
-    PdoCompleteShutdown(Pdo);
+static FORCEINLINE VOID
+__PdoTraceSrb(
+    IN  PXENVBD_PDO             Pdo,
+    IN  PXENVBD_SRBEXT          SrbExt,
+    IN  ULONG64                 Now
+    )
+{
+    PSCSI_REQUEST_BLOCK     Srb = SrbExt->Srb;
+    PXENVBD_IOTRACE_RECORD  Record;
+    LONG64                  Index;
+
+    Index = InterlockedIncrement64(&Pdo->TraceSequence) - 1;
+    Record = &Pdo->Trace[Index & (XENVBD_IOTRACE_RECORDS - 1)];
+
+    Record->StartUs     = HistogramTicksToUs(SrbExt->StartTime);
+    Record->CompleteUs  = HistogramTicksToUs(Now);
+    Record->Length      = Srb->DataTransferLength;
+    Record->Operation   = Cdb_OperationEx(Srb);
+    Record->SrbStatus   = Srb->SrbStatus;
+
+    switch (Record->Operation) {
+    case SCSIOP_READ:
+    case SCSIOP_WRITE:
+        Record->Lba         = Cdb_LogicalBlock(Srb);
+        Record->Alignment   = (USHORT)((ULONG_PTR)Srb->DataBuffer & (PAGE_SIZE - 1));
+        break;
+    default:
+        Record->Lba         = 0;
+        Record->Alignment   = 0;
+        break;
+    }
 }
 
 VOID
 PdoCompleteResponse(
     __in PXENVBD_PDO             Pdo,
     __in ULONG                   Tag,
-    __in SHORT                   Status
+    __in SHORT                   Status,
+    __in ULONG64                 Now
     )
 {
     PXENVBD_REQUEST     Request;
@@ -1532,9 +3156,14 @@ PdoCompleteResponse(
     SrbExt  = GetSrbExt(Srb);
     ASSERT3P(SrbExt, !=, NULL);
 
+    EtwRequestComplete(PdoGetTargetId(Pdo), Request, Status);
+    __PdoRecordLatency(Pdo, Request, SrbExt, Now);
+    __PdoCheckOutlier(Pdo, Request, SrbExt, Now);
+
     switch (Status) {
     case BLKIF_RSP_OKAY:
-        RequestCopyOutput(Request);
+        PROFILE(ProfileCopyOut,
+                RequestCopyOutput(Request));
         break;
 
     case BLKIF_RSP_EOPNOTSUPP:
@@ -1553,7 +3182,8 @@ PdoCompleteResponse(
         break;
     }
 
-    PdoPutRequest(Pdo, Request);
+    PROFILE(ProfileTeardown,
+            PdoPutRequest(Pdo, Request));
 
     // complete srb
     if (InterlockedDecrement(&SrbExt->Count) == 0) {
@@ -1562,13 +3192,116 @@ PdoCompleteResponse(
             // from any of its responses. SRB must have succeeded
             Srb->SrbStatus = SRB_STATUS_SUCCESS;
             Srb->ScsiStatus = 0x00; // SCSI_GOOD
+
+            switch (Cdb_OperationEx(Srb)) {
+            case SCSIOP_READ:
+                __PdoStats(Pdo)->BytesRead += Srb->DataTransferLength;
+                break;
+            case SCSIOP_WRITE:
+                __PdoStats(Pdo)->BytesWritten += Srb->DataTransferLength;
+                break;
+            default:
+                break;
+            }
         } else {
             // Srb->SrbStatus has already been set by 1 or more requests with Status != BLKIF_RSP_OKAY
             Srb->ScsiStatus = 0x40; // SCSI_ABORTED
         }
 
+        ++__PdoStats(Pdo)->CompletedSrbs;
+        __PdoTraceSrb(Pdo, SrbExt, Now);
         FdoCompleteSrb(PdoGetFdo(Pdo), Srb);
     }
+
+    // wake __PdoPauseDataPath once the last submitted request is done
+    if (Pdo->Draining && QueueCount(&Pdo->SubmittedReqs) == 0)
+        KeSetEvent(&Pdo->DrainEvent, IO_NO_INCREMENT, FALSE);
+}
+
+static VOID
+__PdoRevokeGrants(
+    __in PXENVBD_PDO             Pdo,
+    __in PXENVBD_REQUEST         Request
+    )
+{
+    PXENVBD_GRANTER Granter = FrontendGetGranter(Pdo->Frontend);
+    PLIST_ENTRY     Entry;
+
+    for (Entry = Request->Segments.Flink;
+            Entry != &Request->Segments;
+            Entry = Entry->Flink) {
+        PXENVBD_SEGMENT Segment = CONTAINING_RECORD(Entry, XENVBD_SEGMENT, Entry);
+
+        if (Segment->Grant)
+            GranterPut(Granter, Segment->Grant);
+        Segment->Grant = NULL;
+    }
+
+    for (Entry = Request->Indirects.Flink;
+            Entry != &Request->Indirects;
+            Entry = Entry->Flink) {
+        PXENVBD_INDIRECT    Indirect = CONTAINING_RECORD(Entry, XENVBD_INDIRECT, Entry);
+
+        if (Indirect->Grant)
+            GranterPut(Granter, Indirect->Grant);
+        Indirect->Grant = NULL;
+    }
+}
+
+static BOOLEAN
+__PdoRestoreGrants(
+    __in PXENVBD_PDO             Pdo,
+    __in PXENVBD_REQUEST         Request
+    )
+{
+    PXENVBD_GRANTER Granter = FrontendGetGranter(Pdo->Frontend);
+    PLIST_ENTRY     Entry;
+    UCHAR           Operation;
+    BOOLEAN         ReadOnly;
+    NTSTATUS        Status;
+
+    if (Request->NrSegments == 0)
+        return TRUE;    // BLKIF_OP_{WRITE_BARRIER/DISCARD}
+
+    // the new backend may take fewer indirect segments than the old one
+    if (Request->NrSegments > BLKIF_MAX_SEGMENTS_PER_REQUEST &&
+        Request->NrSegments > FrontendGetFeatures(Pdo->Frontend)->Indirect)
+        goto fail1;
+
+    __Operation(Cdb_OperationEx(Request->Srb), &Operation, &ReadOnly);
+
+    for (Entry = Request->Segments.Flink;
+            Entry != &Request->Segments;
+            Entry = Entry->Flink) {
+        PXENVBD_SEGMENT Segment = CONTAINING_RECORD(Entry, XENVBD_SEGMENT, Entry);
+
+        ASSERT3P(Segment->Grant, ==, NULL);
+        Status = GranterGet(Granter, Segment->GrantPfn, ReadOnly, &Segment->Grant);
+        if (!NT_SUCCESS(Status))
+            goto fail2;
+    }
+
+    for (Entry = Request->Indirects.Flink;
+            Entry != &Request->Indirects;
+            Entry = Entry->Flink) {
+        PXENVBD_INDIRECT    Indirect = CONTAINING_RECORD(Entry, XENVBD_INDIRECT, Entry);
+
+        ASSERT3P(Indirect->Grant, ==, NULL);
+        Status = GranterGet(Granter,
+                            MmGetMdlPfnArray(Indirect->Mdl)[0],
+                            TRUE,
+                            &Indirect->Grant);
+        if (!NT_SUCCESS(Status))
+            goto fail3;
+    }
+
+    return TRUE;
+
+fail3:
+fail2:
+    ++__PdoStats(Pdo)->FailedGrants;
+fail1:
+    return FALSE;
 }
 
 VOID
@@ -1577,32 +3310,106 @@ PdoPreResume(
     )
 {
     LIST_ENTRY          List;
+    BOOLEAN             Kept = FALSE;
 
     InitializeListHead(&List);
 
-    // pop all submitted requests, cleanup and add associated SRB to a list
+    // The old backend's ring and grants go with the suspend, but requests
+    // keep their segments, bounce buffers and indirect pages. Move every
+    // submitted request, then every prepared one, onto PreparedReqs in
+    // their original order and only give up their grants. 
+    // PdoResumeRequests grants them to the new backend before the ring is
+    // enabled again.
     for (;;) {
-        PXENVBD_SRBEXT  SrbExt;
-        PXENVBD_REQUEST Request;
-        PLIST_ENTRY     Entry = QueuePop(&Pdo->SubmittedReqs);
+        PLIST_ENTRY     Entry = __PdoPopSubmitted(Pdo);
         if (Entry == NULL)
             break;
+        InsertTailList(&List, Entry);
+    }
+
+    for (;;) {
+        PLIST_ENTRY     Entry = QueuePop(&Pdo->PreparedReqs);
+        if (Entry == NULL)
+            break;
+        InsertTailList(&List, Entry);
+    }
+
+    for (;;) {
+        PXENVBD_REQUEST Request;
+        PLIST_ENTRY     Entry = RemoveHeadList(&List);
+        if (Entry == &List)
+            break;
         Request = CONTAINING_RECORD(Entry, XENVBD_REQUEST, Entry);
-        SrbExt = GetSrbExt(Request->Srb);
 
-        PdoPutRequest(Pdo, Request);
+        __PdoRevokeGrants(Pdo, Request);
+        QueueAppend(&Pdo->PreparedReqs, &Request->Entry);
+        Kept = TRUE;
+    }
 
-        if (InterlockedDecrement(&SrbExt->Count) == 0) {
-            InsertTailList(&List, &SrbExt->Entry);
+    // only hold new SRBs for the reconnect if there is something to replay,
+    // a second suspend before the resume leaves an earlier TRUE alone
+    if (Kept)
+        Pdo->Resuming = TRUE;
+}
+
+__drv_requiresIRQL(DISPATCH_LEVEL)
+VOID
+PdoResumeRequests(
+    __in PXENVBD_PDO             Pdo
+    )
+{
+    LIST_ENTRY          List;
+    LIST_ENTRY          Srbs;
+    PLIST_ENTRY         Entry;
+    BOOLEAN             Success = TRUE;
+    ULONG               Count = 0;
+
+    if (!Pdo->Resuming)
+        return;
+    Pdo->Resuming = FALSE;
+
+    InitializeListHead(&List);
+    InitializeListHead(&Srbs);
+
+    for (;;) {
+        Entry = QueuePop(&Pdo->PreparedReqs);
+        if (Entry == NULL)
+            break;
+        InsertTailList(&List, Entry);
+    }
+
+    for (Entry = List.Flink; Entry != &List; Entry = Entry->Flink) {
+        PXENVBD_REQUEST Request = CONTAINING_RECORD(Entry, XENVBD_REQUEST, Entry);
+
+        if (!__PdoRestoreGrants(Pdo, Request)) {
+            Success = FALSE;
+            break;
         }
+        ++Count;
+    }
+
+    if (Success) {
+        // replay them as they were
+        for (;;) {
+            Entry = RemoveHeadList(&List);
+            if (Entry == &List)
+                break;
+            QueueAppend(&Pdo->PreparedReqs, Entry);
+        }
+
+        Pdo->ResumeReplayed += Count;
+        Verbose("Target[%d] : %u requests replayed\n", PdoGetTargetId(Pdo), Count);
+        return;
     }
 
-    // pop all prepared requests, cleanup and add associated SRB to a list
+    // Could not grant them all, so rebuild every SRB from scratch. Tear the
+    // requests down and put their SRBs back on the front of FreshSrbs
+    Count = 0;
     for (;;) {
-        PXENVBD_SRBEXT  SrbExt;
         PXENVBD_REQUEST Request;
-        PLIST_ENTRY     Entry = QueuePop(&Pdo->PreparedReqs);
-        if (Entry == NULL)
+        PXENVBD_SRBEXT  SrbExt;
+        Entry = RemoveHeadList(&List);
+        if (Entry == &List)
             break;
         Request = CONTAINING_RECORD(Entry, XENVBD_REQUEST, Entry);
         SrbExt = GetSrbExt(Request->Srb);
@@ -1610,23 +3417,23 @@ PdoPreResume(
         PdoPutRequest(Pdo, Request);
 
         if (InterlockedDecrement(&SrbExt->Count) == 0) {
-            InsertTailList(&List, &SrbExt->Entry);
+            InsertTailList(&Srbs, &SrbExt->Entry);
+            ++Count;
         }
     }
 
-    // foreach SRB in list, put on start of FreshSrbs
     for (;;) {
         PXENVBD_SRBEXT  SrbExt;
-        PLIST_ENTRY     Entry = RemoveTailList(&List);
-        if (Entry == &List)
+        Entry = RemoveTailList(&Srbs);
+        if (Entry == &Srbs)
             break;
         SrbExt = CONTAINING_RECORD(Entry, XENVBD_SRBEXT, Entry);
 
         QueueUnPop(&Pdo->FreshSrbs, &SrbExt->Entry);
     }
 
-    // now the first set of requests popped off submitted list is the next SRB 
-    // to be popped off the fresh list
+    Pdo->ResumeRebuilt += Count;
+    Warning("Target[%d] : %u SRBs rebuilt\n", PdoGetTargetId(Pdo), Count);
 }
 
 VOID
@@ -1687,6 +3494,17 @@ __ValidateSrbBuffer(
     return TRUE;
 }
 
+static FORCEINLINE BOOLEAN
+__PdoIsReady(
+    __in PXENVBD_PDO            Pdo
+    )
+{
+    // From a suspend until the resume thread reconnects the new backend the
+    // frontend is not connected, but the ring is disabled so new SRBs just
+    // wait on FreshSrbs alongside the requests kept across the resume
+    return FrontendGetCaps(Pdo->Frontend)->Connected || Pdo->Resuming;
+}
+
 __checkReturn
 static DECLSPEC_NOINLINE BOOLEAN
 PdoReadWrite(
@@ -1696,23 +3514,24 @@ PdoReadWrite(
 {
     PXENVBD_DISKINFO    DiskInfo = FrontendGetDiskInfo(Pdo->Frontend);
     PXENVBD_SRBEXT      SrbExt = GetSrbExt(Srb);
-    PXENVBD_NOTIFIER    Notifier = FrontendGetNotifier(Pdo->Frontend);
+    BOOLEAN             Valid;
 
-    if (FrontendGetCaps(Pdo->Frontend)->Connected == FALSE) {
+    if (!__PdoIsReady(Pdo)) {
         Trace("Target[%d] : Not Ready, fail SRB\n", PdoGetTargetId(Pdo));
         Srb->ScsiStatus = 0x40; // SCSI_ABORT;
         return TRUE;
     }
 
     // check valid sectors
-    if (!__ValidateSectors(DiskInfo->SectorCount, Cdb_LogicalBlock(Srb), Cdb_TransferBlock(Srb))) {
+    PROFILE(ProfileValidate,
+            Valid = __ValidateSectors(DiskInfo->SectorCount, Cdb_LogicalBlock(Srb), Cdb_TransferBlock(Srb)));
+    if (!Valid) {
         Trace("Target[%d] : Invalid Sector (%d @ %lld < %lld)\n", PdoGetTargetId(Pdo), Cdb_TransferBlock(Srb), Cdb_LogicalBlock(Srb), DiskInfo->SectorCount);
         Srb->ScsiStatus = 0x40; // SCSI_ABORT
         return TRUE; // Complete now
     }
 
-    QueueAppend(&Pdo->FreshSrbs, &SrbExt->Entry);
-    NotifierKick(Notifier);
+    PdoQueueFresh(Pdo, SrbExt);
 
     return FALSE;
 }
@@ -1725,9 +3544,8 @@ PdoSyncCache(
     )
 {
     PXENVBD_SRBEXT      SrbExt = GetSrbExt(Srb);
-    PXENVBD_NOTIFIER    Notifier = FrontendGetNotifier(Pdo->Frontend);
 
-    if (FrontendGetCaps(Pdo->Frontend)->Connected == FALSE) {
+    if (!__PdoIsReady(Pdo)) {
         Trace("Target[%d] : Not Ready, fail SRB\n", PdoGetTargetId(Pdo));
         Srb->ScsiStatus = 0x40; // SCSI_ABORT;
         return TRUE;
@@ -1740,8 +3558,7 @@ PdoSyncCache(
         return TRUE;
     }
 
-    QueueAppend(&Pdo->FreshSrbs, &SrbExt->Entry);
-    NotifierKick(Notifier);
+    PdoQueueFresh(Pdo, SrbExt);
 
     return FALSE;
 }
@@ -1754,9 +3571,8 @@ PdoUnmap(
     )
 {
     PXENVBD_SRBEXT      SrbExt = GetSrbExt(Srb);
-    PXENVBD_NOTIFIER    Notifier = FrontendGetNotifier(Pdo->Frontend);
 
-    if (FrontendGetCaps(Pdo->Frontend)->Connected == FALSE) {
+    if (!__PdoIsReady(Pdo)) {
         Trace("Target[%d] : Not Ready, fail SRB\n", PdoGetTargetId(Pdo));
         Srb->ScsiStatus = 0x40; // SCSI_ABORT;
         return TRUE;
@@ -1769,8 +3585,7 @@ PdoUnmap(
         return TRUE;
     }
 
-    QueueAppend(&Pdo->FreshSrbs, &SrbExt->Entry);
-    NotifierKick(Notifier);
+    PdoQueueFresh(Pdo, SrbExt);
 
     return FALSE;
 }
@@ -2115,13 +3930,12 @@ __PdoReset(
     __in PSCSI_REQUEST_BLOCK     Srb
     )
 {
-    Verbose("Target[%u] ====>\n", PdoGetTargetId(Pdo));
+    Verbose("Target[%u] : Reset queued\n", PdoGetTargetId(Pdo));
 
-    PdoReset(Pdo);
-    Srb->SrbStatus = SRB_STATUS_SUCCESS;
-
-    Verbose("Target[%u] <====\n", PdoGetTargetId(Pdo));
-    return TRUE;
+    // PdoReset waits for the backend, which StartIo cannot do at
+    // DISPATCH_LEVEL
+    FdoQueueReset(PdoGetFdo(Pdo), Srb);
+    return FALSE;
 }
 
 __checkReturn
@@ -2178,7 +3992,17 @@ PdoStartIo(
     __in PSCSI_REQUEST_BLOCK     Srb
     )
 {
-    if (!__ValidateSrbForPdo(Pdo, Srb))
+    PXENVBD_SRBEXT  SrbExt = GetSrbExt(Srb);
+    BOOLEAN         Valid;
+
+    if (SrbExt)
+        SrbExt->StartTime = HistogramNow();
+
+    EtwSrbStart(Srb);
+
+    PROFILE(ProfileValidate,
+            Valid = __ValidateSrbForPdo(Pdo, Srb));
+    if (!Valid)
         return TRUE;
 
     switch (Srb->Function) {
@@ -2206,7 +4030,7 @@ __PdoCleanupSubmittedReqs(
     for (;;) {
         PXENVBD_SRBEXT  SrbExt;
         PXENVBD_REQUEST Request;
-        PLIST_ENTRY     Entry = QueuePop(&Pdo->SubmittedReqs);
+        PLIST_ENTRY     Entry = __PdoPopSubmitted(Pdo);
         if (Entry == NULL)
             break;
         Request = CONTAINING_RECORD(Entry, XENVBD_REQUEST, Entry);
@@ -2241,19 +4065,35 @@ PdoReset(
     }
 
     Status = FrontendSetState(Pdo->Frontend, XENVBD_CLOSING);
+    if (Status == STATUS_DEVICE_BUSY)
+        goto busy;
     ASSERT(NT_SUCCESS(Status));
 
     __PdoCleanupSubmittedReqs(Pdo);
 
     Status = FrontendSetState(Pdo->Frontend, XENVBD_CLOSED);
+    if (Status == STATUS_DEVICE_BUSY)
+        goto busy;
     ASSERT(NT_SUCCESS(Status));
 
     Status = FrontendSetState(Pdo->Frontend, XENVBD_ENABLED);
+    if (Status == STATUS_DEVICE_BUSY)
+        goto busy;
     ASSERT(NT_SUCCESS(Status));
 
+done:
     __PdoUnpauseDataPath(Pdo);
 
     Trace("Target[%d] <==== (Irql=%d)\n", PdoGetTargetId(Pdo), KeGetCurrentIrql());
+    return;
+
+busy:
+    // a power transition is already reconnecting the frontend, which
+    // leaves nothing to complete whatever is still on SubmittedReqs
+    Warning("Target[%d] : reset overtaken by a transition, failing %u requests\n",
+            PdoGetTargetId(Pdo), QueueCount(&Pdo->SubmittedReqs));
+    __PdoCleanupSubmittedReqs(Pdo);
+    goto done;
 }
 
 //=============================================================================
@@ -2476,13 +4316,41 @@ PdoIssueDeviceEject(
     }
 }
 
-__drv_requiresIRQL(DISPATCH_LEVEL)
-VOID
+__drv_maxIRQL(DISPATCH_LEVEL)
+BOOLEAN
 PdoBackendPathChanged(
     __in PXENVBD_PDO             Pdo
     )
 {
-    FrontendBackendPathChanged(Pdo->Frontend);
+    return FrontendBackendPathChanged(Pdo->Frontend);
+}
+
+__checkReturn
+__drv_maxIRQL(PASSIVE_LEVEL)
+NTSTATUS
+PdoResume(
+    __in PXENVBD_PDO             Pdo
+    )
+{
+    NTSTATUS    Status;
+
+    Status = FrontendResume(Pdo->Frontend);
+    if (NT_SUCCESS(Status) || !Pdo->Resuming)
+        return Status;
+
+    // The new backend never connected, so PdoResumeRequests will not run.
+    // Stop holding SRBs for it and fail the kept requests and anything
+    // queued behind them, as a disconnected target would
+    Warning("Target[%d] : resume failed (%08x), failing held requests\n",
+            PdoGetTargetId(Pdo), Status);
+
+    Pdo->Resuming = FALSE;
+    KeMemoryBarrier();
+
+    __PdoPauseDataPath(Pdo, TRUE);
+    __PdoUnpauseDataPath(Pdo);
+
+    return Status;
 }
 
 __checkReturn
@@ -2561,7 +4429,6 @@ PdoCreate(
     __in __nullterminated PCHAR  DeviceId,
     __in ULONG                   TargetId,
     __in BOOLEAN                 EmulatedUnplugged,
-    __in PKEVENT                 FrontendEvent,
     __in XENVBD_DEVICE_TYPE      DeviceType
     )
 {
@@ -2589,42 +4456,52 @@ PdoCreate(
     Pdo->DeviceType     = DeviceType;
 
     KeInitializeSpinLock(&Pdo->Lock);
-    QueueInit(&Pdo->FreshSrbs);
+    KeInitializeSpinLock(&Pdo->SubmitLock);
+    KeInitializeEvent(&Pdo->DrainEvent, NotificationEvent, FALSE);
+    QueueInitMpsc(&Pdo->FreshSrbs);
     QueueInit(&Pdo->PreparedReqs);
     QueueInit(&Pdo->SubmittedReqs);
     QueueInit(&Pdo->ShutdownSrbs);
 
-    Status = FrontendCreate(Pdo, DeviceId, TargetId, FrontendEvent, &Pdo->Frontend);
+    Status = __PdoAllocateStats(Pdo);
     if (!NT_SUCCESS(Status))
         goto fail2;
 
+    Status = FrontendCreate(Pdo, DeviceId, TargetId, &Pdo->Frontend);
+    if (!NT_SUCCESS(Status))
+        goto fail3;
+
     __LookasideInit(&Pdo->RequestList, sizeof(XENVBD_REQUEST), REQUEST_POOL_TAG);
     __LookasideInit(&Pdo->SegmentList, sizeof(XENVBD_SEGMENT), SEGMENT_POOL_TAG);
     __LookasideInit(&Pdo->IndirectList, sizeof(XENVBD_INDIRECT), INDIRECT_POOL_TAG);
 
     Status = PdoD3ToD0(Pdo);
     if (!NT_SUCCESS(Status))
-        goto fail3;
+        goto fail4;
 
     if (!FdoLinkPdo(Fdo, Pdo))
-        goto fail4;
+        goto fail5;
 
     Verbose("Target[%d] : Created (%s)\n", TargetId, EmulatedUnplugged ? "PV" : "Emulated");
     Trace("Target[%d] @ (%d) <=====\n", TargetId, KeGetCurrentIrql());
     return STATUS_SUCCESS;
 
-fail4:
-    Error("Fail4\n");
+fail5:
+    Error("Fail5\n");
     PdoD0ToD3(Pdo);
 
-fail3:
-    Error("Fail3\n");
+fail4:
+    Error("Fail4\n");
     __LookasideTerm(&Pdo->IndirectList);
     __LookasideTerm(&Pdo->SegmentList);
     __LookasideTerm(&Pdo->RequestList);
     FrontendDestroy(Pdo->Frontend);
     Pdo->Frontend = NULL;
 
+fail3:
+    Error("Fail3\n");
+    __PdoFreeStats(Pdo);
+
 fail2:
     Error("Fail2\n");
     __PdoFree(Pdo);
@@ -2696,6 +4573,12 @@ PdoDestroy(
     FrontendDestroy(Pdo->Frontend);
     Pdo->Frontend = NULL;
 
+    // hand any credit left back to the FDO
+    ASSERT3S(Pdo->MemoryUsed, ==, 0);
+    PdoReclaimMemory(Pdo);
+
+    __PdoFreeStats(Pdo);
+
     ASSERT3U(Pdo->Signature, ==, PDO_SIGNATURE);
     RtlZeroMemory(Pdo, sizeof(XENVBD_PDO));
     __PdoFree(Pdo);
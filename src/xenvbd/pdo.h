@@ -40,6 +40,8 @@ typedef struct _XENVBD_PDO XENVBD_PDO, *PXENVBD_PDO;
 #include "fdo.h"
 #include "srbext.h"
 #include "types.h"
+#include "wmi.h"
+#include "iotrace.h"
 #include <debug_interface.h>
 
 extern VOID
@@ -48,6 +50,39 @@ PdoDebugCallback(
     __in PXENBUS_DEBUG_INTERFACE Debug
     );
 
+extern VOID
+PdoQueryWmiStats(
+    __in PXENVBD_PDO                Pdo,
+    __out PXENVBD_WMI_TARGET_STATS  Stats
+    );
+
+extern VOID
+PdoReadTrace(
+    __in PXENVBD_PDO                Pdo,
+    __out_ecount(Maximum) PXENVBD_IOTRACE_RECORD Records,
+    __in ULONG                      Maximum,
+    __out PULONG                    Count,
+    __out PULONG64                  Sequence
+    );
+
+extern VOID
+PdoQueryWmiOutliers(
+    __in PXENVBD_PDO                    Pdo,
+    __out PXENVBD_WMI_TARGET_OUTLIERS   Outliers
+    );
+
+__drv_maxIRQL(PASSIVE_LEVEL)
+extern VOID
+PdoPublishStats(
+    __in PXENVBD_PDO                Pdo
+    );
+
+__drv_maxIRQL(DISPATCH_LEVEL)
+extern VOID
+PdoScanOutliers(
+    __in PXENVBD_PDO                Pdo
+    );
+
 // Creation/Deletion
 __checkReturn
 extern NTSTATUS
@@ -56,7 +91,6 @@ PdoCreate(
     __in __nullterminated PCHAR  DeviceId,
     __in ULONG                   TargetId,
     __in BOOLEAN                 EmulatedMasked,
-    __in PKEVENT                 FrontendEvent,
     __in XENVBD_DEVICE_TYPE      DeviceType
     );
 
@@ -76,8 +110,8 @@ PdoD0ToD3(
     __in PXENVBD_PDO             Pdo
     );
 
-__drv_requiresIRQL(DISPATCH_LEVEL)
-extern VOID
+__drv_maxIRQL(DISPATCH_LEVEL)
+extern BOOLEAN
 PdoBackendPathChanged(
     __in PXENVBD_PDO             Pdo
     );
@@ -182,11 +216,18 @@ PdoSubmitRequests(
     __in PXENVBD_PDO             Pdo
     );
 
+// Schedules the DPC to retry SRBs waiting for resources
+extern VOID
+PdoKickRequests(
+    __in PXENVBD_PDO             Pdo
+    );
+
 extern VOID
 PdoCompleteResponse(
     __in PXENVBD_PDO             Pdo,
     __in ULONG                   Tag,
-    __in SHORT                   Status
+    __in SHORT                   Status,
+    __in ULONG64                 Now
     );
 
 extern VOID
@@ -199,6 +240,25 @@ PdoPostResume(
     __in PXENVBD_PDO             Pdo
     );
 
+__drv_requiresIRQL(DISPATCH_LEVEL)
+extern VOID
+PdoResumeRequests(
+    __in PXENVBD_PDO             Pdo
+    );
+
+__checkReturn
+__drv_maxIRQL(PASSIVE_LEVEL)
+extern NTSTATUS
+PdoResume(
+    __in PXENVBD_PDO             Pdo
+    );
+
+// Memory Budget
+extern VOID
+PdoReclaimMemory(
+    __in PXENVBD_PDO             Pdo
+    );
+
 // StorPort Methods
 extern VOID
 PdoReset(
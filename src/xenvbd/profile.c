@@ -0,0 +1,148 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, 
+ * with or without modification, are permitted provided 
+ * that the following conditions are met:
+ * 
+ * *   Redistributions of source code must retain the above 
+ *     copyright notice, this list of conditions and the 
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above 
+ *     copyright notice, this list of conditions and the 
+ *     following disclaimer in the documentation and/or other 
+ *     materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND 
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF 
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR 
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF 
+ * SUCH DAMAGE.
+ */ 
+
+#include "profile.h"
+#include "debug.h"
+#include "assert.h"
+
+#if defined(XENVBD_PROFILE)
+
+// CPUs beyond this are not profiled
+#define PROFILE_MAX_CPUS    64
+
+// padded to a cache line on purpose, so C4324 is expected
+#pragma warning(push)
+#pragma warning(disable:4324)
+
+typedef struct _XENVBD_PROFILE_CPU {
+    ULONG64             Cycles[ProfileStages];
+    ULONG64             Count[ProfileStages];
+} DECLSPEC_CACHEALIGN XENVBD_PROFILE_CPU, *PXENVBD_PROFILE_CPU;
+
+#pragma warning(pop)
+
+static XENVBD_PROFILE_CPU   ProfileCpu[PROFILE_MAX_CPUS];
+
+static const PCHAR
+__ProfileStageName(
+    __in ULONG                  Stage
+    )
+{
+    switch (Stage) {
+    case ProfileValidate:       return "VALIDATE";
+    case ProfileQueue:          return "QUEUE";
+    case ProfileSegmentWalk:    return "SEGMENT_WALK";
+    case ProfileMap:            return "MAP";
+    case ProfileBounce:         return "BOUNCE";
+    case ProfileGrant:          return "GRANT";
+    case ProfileSubmit:         return "SUBMIT";
+    case ProfileNotify:         return "NOTIFY";
+    case ProfilePoll:           return "POLL";
+    case ProfileCopyOut:        return "COPY_OUT";
+    case ProfileTeardown:       return "TEARDOWN";
+    case ProfileComplete:       return "COMPLETE";
+    default:                    return "UNKNOWN";
+    }
+}
+
+VOID
+ProfileAdd(
+    __in XENVBD_PROFILE_STAGE   Stage,
+    __in ULONG64                Cycles
+    )
+{
+    ULONG               Cpu = KeGetCurrentProcessorNumberEx(NULL);
+    PXENVBD_PROFILE_CPU Profile;
+
+    if (Cpu >= PROFILE_MAX_CPUS)
+        return;
+
+    // not interlocked, a stage running at PASSIVE_LEVEL may migrate and
+    // race with the new CPU's owner, which only costs an occasional sample
+    Profile = &ProfileCpu[Cpu];
+    Profile->Cycles[Stage] += Cycles;
+    ++Profile->Count[Stage];
+}
+
+VOID
+ProfileDebugCallback(
+    __in PXENBUS_DEBUG_INTERFACE    Debug
+    )
+{
+    ULONG   Stage;
+    ULONG   Cpu;
+
+    for (Stage = 0; Stage < ProfileStages; ++Stage) {
+        ULONG64 Cycles = 0;
+        ULONG64 Count = 0;
+
+        for (Cpu = 0; Cpu < PROFILE_MAX_CPUS; ++Cpu) {
+            Cycles += ProfileCpu[Cpu].Cycles[Stage];
+            Count  += ProfileCpu[Cpu].Count[Stage];
+        }
+        if (Count == 0)
+            continue;
+
+        XENBUS_DEBUG(Printf, Debug,
+                     "PROFILE: %-12s : %llu calls %llu cycles (%llu avg)\n",
+                     __ProfileStageName(Stage),
+                     Count,
+                     Cycles,
+                     Cycles / Count);
+
+        for (Cpu = 0; Cpu < PROFILE_MAX_CPUS; ++Cpu) {
+            PXENVBD_PROFILE_CPU Profile = &ProfileCpu[Cpu];
+
+            if (Profile->Count[Stage] == 0)
+                continue;
+
+            XENBUS_DEBUG(Printf, Debug,
+                         "PROFILE: %-12s : CPU%-3u %llu calls %llu cycles (%llu avg)\n",
+                         __ProfileStageName(Stage),
+                         Cpu,
+                         Profile->Count[Stage],
+                         Profile->Cycles[Stage],
+                         Profile->Cycles[Stage] / Profile->Count[Stage]);
+        }
+    }
+}
+
+#else   // XENVBD_PROFILE
+
+VOID
+ProfileDebugCallback(
+    __in PXENBUS_DEBUG_INTERFACE    Debug
+    )
+{
+    UNREFERENCED_PARAMETER(Debug);
+}
+
+#endif  // XENVBD_PROFILE
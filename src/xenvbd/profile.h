@@ -0,0 +1,88 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, 
+ * with or without modification, are permitted provided 
+ * that the following conditions are met:
+ * 
+ * *   Redistributions of source code must retain the above 
+ *     copyright notice, this list of conditions and the 
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above 
+ *     copyright notice, this list of conditions and the 
+ *     following disclaimer in the documentation and/or other 
+ *     materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND 
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF 
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR 
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF 
+ * SUCH DAMAGE.
+ */ 
+
+#ifndef _XENVBD_PROFILE_H
+#define _XENVBD_PROFILE_H
+
+#include <ntddk.h>
+#include <debug_interface.h>
+
+// Per-stage CPU cost of the data path, in TSC cycles, aggregated per CPU.
+// Compiled out unless the driver is built with XENVBD_PROFILE defined
+
+typedef enum _XENVBD_PROFILE_STAGE {
+    ProfileValidate = 0,    // SRB validation
+    ProfileQueue,           // FreshSrbs / PreparedReqs queueing
+    ProfileSegmentWalk,     // SGListNext
+    ProfileMap,             // MapSegmentBuffer
+    ProfileBounce,          // BufferGet and BufferCopyIn
+    ProfileGrant,           // GranterGet
+    ProfileSubmit,          // BlockRingSubmit, building the blkif request
+    ProfileNotify,          // NotifierSend
+    ProfilePoll,            // __BlockRingHarvest
+    ProfileCopyOut,         // RequestCopyOutput
+    ProfileTeardown,        // PdoPutRequest
+    ProfileComplete,        // StorPortNotification(RequestComplete)
+    ProfileStages
+} XENVBD_PROFILE_STAGE;
+
+extern VOID
+ProfileDebugCallback(
+    __in PXENBUS_DEBUG_INTERFACE    Debug
+    );
+
+#if defined(XENVBD_PROFILE)
+
+extern VOID
+ProfileAdd(
+    __in XENVBD_PROFILE_STAGE   Stage,
+    __in ULONG64                Cycles
+    );
+
+// PROFILE(Stage, Statement) runs Statement, charging its cycles to Stage
+#define PROFILE(_Stage, ...)                                        \
+        do {                                                        \
+            ULONG64 __ProfileStart = ReadTimeStampCounter();        \
+            __VA_ARGS__;                                            \
+            ProfileAdd((_Stage),                                    \
+                       ReadTimeStampCounter() - __ProfileStart);    \
+        } while (FALSE)
+
+#else   // XENVBD_PROFILE
+
+#define PROFILE(_Stage, ...)                                        \
+        do {                                                        \
+            __VA_ARGS__;                                            \
+        } while (FALSE)
+
+#endif  // XENVBD_PROFILE
+
+#endif // _XENVBD_PROFILE_H
@@ -43,6 +43,86 @@ QueueInit(
     InitializeListHead(&Queue->List);
 }
 
+VOID
+QueueInitMpsc(
+    __in PXENVBD_QUEUE      Queue
+    )
+{
+    QueueInit(Queue);
+    Queue->Mpsc = TRUE;
+}
+
+static FORCEINLINE VOID
+__QueueIncrement(
+    __in PXENVBD_QUEUE      Queue
+    )
+{
+    LONG    Current = InterlockedIncrement((PLONG)&Queue->Current);
+    LONG    Maximum;
+
+    // producers may increment concurrently, so a plain store could let a
+    // smaller count overwrite a larger one
+    do {
+        Maximum = *(volatile LONG *)&Queue->Maximum;
+        if (Current <= Maximum)
+            break;
+    } while (InterlockedCompareExchange((PLONG)&Queue->Maximum,
+                                        Current,
+                                        Maximum) != Maximum);
+}
+
+static FORCEINLINE VOID
+__QueueDecrement(
+    __in PXENVBD_QUEUE      Queue
+    )
+{
+    (VOID) InterlockedDecrement((PLONG)&Queue->Current);
+}
+
+static FORCEINLINE VOID
+__QueueDrainPending(
+    __in PXENVBD_QUEUE      Queue
+    )
+{
+    PLIST_ENTRY Tail;
+    PLIST_ENTRY Entry;
+
+    // called with Lock held
+    Entry = InterlockedExchangePointer((PVOID volatile *)&Queue->Pending, NULL);
+
+    // Pending is newest first, inserting each one directly after the
+    // current tail leaves the batch in arrival order
+    Tail = Queue->List.Blink;
+    while (Entry != NULL) {
+        PLIST_ENTRY Next = Entry->Flink;
+
+        InsertHeadList(Tail, Entry);
+        Entry = Next;
+    }
+}
+
+static FORCEINLINE VOID
+__QueuePush(
+    __in PXENVBD_QUEUE      Queue,
+    __in PLIST_ENTRY        Entry
+    )
+{
+    PLIST_ENTRY Old;
+
+    // count the entry before publishing it, otherwise the consumer can pop
+    // it and decrement Current first, and QueueCount briefly reads a
+    // wrapped-around value
+    __QueueIncrement(Queue);
+
+    do {
+        Old = Queue->Pending;
+        Entry->Flink = Old;
+        Entry->Blink = NULL;
+    } while (InterlockedCompareExchangePointer((PVOID volatile *)&Queue->Pending,
+                                               Entry,
+                                               Old) != Old);
+}
+
 ULONG
 QueueCount(
     __in PXENVBD_QUEUE      Queue
@@ -62,10 +142,13 @@ QueuePop(
 
     KeAcquireSpinLock(&Queue->Lock, &Irql);
 
+    if (Queue->Mpsc && IsListEmpty(&Queue->List))
+        __QueueDrainPending(Queue);
+
     if (!IsListEmpty(&Queue->List)) {
         Entry = RemoveHeadList(&Queue->List);
         ASSERT3P(Entry, !=, &Queue->List);
-        --Queue->Current;
+        __QueueDecrement(Queue);
     }
 
     KeReleaseSpinLock(&Queue->Lock, Irql);
@@ -84,8 +167,7 @@ QueueUnPop(
     KeAcquireSpinLock(&Queue->Lock, &Irql);
     
     InsertHeadList(&Queue->List, Entry);
-    if (++Queue->Current > Queue->Maximum)
-        Queue->Maximum = Queue->Current;
+    __QueueIncrement(Queue);
     
     KeReleaseSpinLock(&Queue->Lock, Irql);
 }
@@ -98,11 +180,15 @@ QueueAppend(
 {
     KIRQL               Irql;
 
+    if (Queue->Mpsc) {
+        __QueuePush(Queue, Entry);
+        return;
+    }
+
     KeAcquireSpinLock(&Queue->Lock, &Irql);
     
     InsertTailList(&Queue->List, Entry);
-    if (++Queue->Current > Queue->Maximum)
-        Queue->Maximum = Queue->Current;
+    __QueueIncrement(Queue);
     
     KeReleaseSpinLock(&Queue->Lock, Irql);
 }
@@ -117,8 +203,11 @@ QueueRemove(
 
     KeAcquireSpinLock(&Queue->Lock, &Irql);
 
+    if (Queue->Mpsc)
+        __QueueDrainPending(Queue);
+
     RemoveEntryList(Entry);
-    --Queue->Current;
+    __QueueDecrement(Queue);
     
     KeReleaseSpinLock(&Queue->Lock, Irql);
 }
@@ -133,7 +222,5 @@ QueueDebugCallback(
     XENBUS_DEBUG(Printf, Debug,
                  "QUEUE: %s : %u / %u\n",
                  Name, Queue->Current, Queue->Maximum);
-
-    Queue->Maximum = Queue->Current;
 }
 
@@ -40,6 +40,13 @@ typedef struct _XENVBD_QUEUE {
     LIST_ENTRY          List;
     ULONG               Current;
     ULONG               Maximum;
+
+    // Multi-producer/single-consumer mode
+    // QueueAppend pushes onto Pending (LIFO, linked through Flink) without
+    // taking Lock, the consumer moves the whole batch onto List with one
+    // exchange when List runs dry
+    BOOLEAN             Mpsc;
+    PLIST_ENTRY volatile Pending;
 } XENVBD_QUEUE, *PXENVBD_QUEUE;
 
 extern VOID
@@ -47,6 +54,11 @@ QueueInit(
     __in PXENVBD_QUEUE      Queue
     );
 
+extern VOID
+QueueInitMpsc(
+    __in PXENVBD_QUEUE      Queue
+    );
+
 extern ULONG
 QueueCount(
     __in PXENVBD_QUEUE      Queue
@@ -67,6 +67,7 @@ typedef struct _XENVBD_SEGMENT {
     PVOID                   Buffer; // VirtAddr mapped to PhysAddr(s)
     MDL                     Mdl;
     PFN_NUMBER              Pfn[2];
+    PFN_NUMBER              GrantPfn;   // page behind Grant, kept across resume
 } XENVBD_SEGMENT, *PXENVBD_SEGMENT;
 
 // Internal request context
@@ -83,13 +84,29 @@ typedef struct _XENVBD_REQUEST {
     ULONG64                 FirstSector;
     ULONG64                 NrSectors;  // BLKIF_OP_DISCARD only
     LIST_ENTRY              Indirects;  // BLKIF_OP_{READ/WRITE} with NrSegments > 11 only
+
+    ULONG64                 SubmitTime; // HistogramNow() when put on the ring
+    ULONG                   RingIndex;  // req_prod when put on the ring
+    BOOLEAN                 Outlier;    // already captured while outstanding
 } XENVBD_REQUEST, *PXENVBD_REQUEST;
 
+// Requests and segments embedded in the SRBExtension, enough for 2 direct
+// BLKIF_OP_{READ/WRITE}s. Larger SRBs overflow into the PDO's lookasides
+#define XENVBD_SRBEXT_REQUESTS      2
+#define XENVBD_SRBEXT_SEGMENTS      (XENVBD_SRBEXT_REQUESTS * BLKIF_MAX_SEGMENTS_PER_REQUEST)
+
 // SRBExtension - context for SRBs
 typedef struct _XENVBD_SRBEXT {
     PSCSI_REQUEST_BLOCK     Srb;
     LIST_ENTRY              Entry;
     LONG                    Count;
+    ULONG64                 StartTime;  // HistogramNow() at StartIo
+
+    // Embedded arena, not zeroed by InitSrbExt
+    ULONG                   RequestsUsed;
+    ULONG                   SegmentsUsed;
+    XENVBD_REQUEST          Requests[XENVBD_SRBEXT_REQUESTS];
+    XENVBD_SEGMENT          Segments[XENVBD_SRBEXT_SEGMENTS];
 } XENVBD_SRBEXT, *PXENVBD_SRBEXT;
 
 FORCEINLINE PXENVBD_SRBEXT
@@ -111,10 +128,39 @@ InitSrbExt(
 {
     PXENVBD_SRBEXT  SrbExt = GetSrbExt(Srb);
     if (SrbExt) {
-        RtlZeroMemory(SrbExt, sizeof(XENVBD_SRBEXT));
+        RtlZeroMemory(SrbExt, FIELD_OFFSET(XENVBD_SRBEXT, Requests));
         SrbExt->Srb = Srb;
     }
     Srb->SrbStatus = SRB_STATUS_INVALID_REQUEST;
 }
 
+FORCEINLINE VOID
+SrbExtResetArena(
+    __in PXENVBD_SRBEXT         SrbExt
+    )
+{
+    SrbExt->RequestsUsed = 0;
+    SrbExt->SegmentsUsed = 0;
+}
+
+FORCEINLINE BOOLEAN
+SrbExtOwnsRequest(
+    __in PXENVBD_SRBEXT         SrbExt,
+    __in PXENVBD_REQUEST        Request
+    )
+{
+    return Request >= &SrbExt->Requests[0] &&
+           Request < &SrbExt->Requests[XENVBD_SRBEXT_REQUESTS];
+}
+
+FORCEINLINE BOOLEAN
+SrbExtOwnsSegment(
+    __in PXENVBD_SRBEXT         SrbExt,
+    __in PXENVBD_SEGMENT        Segment
+    )
+{
+    return Segment >= &SrbExt->Segments[0] &&
+           Segment < &SrbExt->Segments[XENVBD_SRBEXT_SEGMENTS];
+}
+
 #endif // _XENVBD_SRBEXT_H
@@ -126,6 +126,26 @@ ThreadWait(
     return !Thread->Alerted;
 }
 
+__checkReturn
+__drv_maxIRQL(PASSIVE_LEVEL)
+BOOLEAN
+ThreadWaitTimeout(
+    __in PXENVBD_THREAD  Thread,
+    __in PLARGE_INTEGER  Timeout
+    )
+{
+    ASSERT3U(KeGetCurrentIrql(), ==, PASSIVE_LEVEL);
+    ASSERT((Thread->Thread == NULL) || (Thread->Thread == KeGetCurrentThread()));
+
+    (VOID) KeWaitForSingleObject(&Thread->WorkEvent, 
+                                Executive, 
+                                KernelMode, 
+                                FALSE, 
+                                Timeout);
+    KeClearEvent(&Thread->WorkEvent);
+    return !Thread->Alerted;
+}
+
 KSTART_ROUTINE  ThreadFunction;
 
 VOID
@@ -79,6 +79,14 @@ ThreadWait(
     __in PXENVBD_THREAD  Thread
     );
 
+__checkReturn
+__drv_maxIRQL(PASSIVE_LEVEL)
+extern BOOLEAN
+ThreadWaitTimeout(
+    __in PXENVBD_THREAD  Thread,
+    __in PLARGE_INTEGER  Timeout
+    );
+
 __drv_maxIRQL(PASSIVE_LEVEL)
 extern VOID
 ThreadJoin(
@@ -35,6 +35,13 @@
 #include <ntddk.h>
 
 #include "assert.h"
+#include "numa.h"
+
+// Kernel timeouts and interrupt time are in 100ns units
+#define TIME_US(_us)        ((_us) * 10)
+#define TIME_MS(_ms)        (TIME_US((_ms) * 1000))
+#define TIME_S(_s)          (TIME_MS((_s) * 1000))
+#define TIME_RELATIVE(_t)   (-(_t))
 
 static FORCEINLINE ULONG
 __min(
@@ -133,7 +140,8 @@ __FreePoolWithTag(
 
 static FORCEINLINE PMDL
 __AllocPagesForMdl(
-    IN  SIZE_T          Size
+    IN  SIZE_T          Size,
+    IN  ULONG           Node
     )
 {
     PMDL                Mdl;
@@ -146,7 +154,7 @@ __AllocPagesForMdl(
 
     // try > 4GB
     LowAddr.QuadPart = 0x100000000ull;
-    Mdl = MmAllocatePagesForMdlEx(LowAddr, HighAddr, SkipBytes, Size, MmCached, 0);
+    Mdl = NumaAllocatePagesForMdl(LowAddr, HighAddr, SkipBytes, Size, Node);
     if (Mdl) {
         if (MmGetMdlByteCount(Mdl) == Size) {
             goto done;
@@ -158,7 +166,7 @@ __AllocPagesForMdl(
 
     // try > 2GB
     LowAddr.QuadPart = 0x80000000ull;
-    Mdl = MmAllocatePagesForMdlEx(LowAddr, HighAddr, SkipBytes, Size, MmCached, 0);
+    Mdl = NumaAllocatePagesForMdl(LowAddr, HighAddr, SkipBytes, Size, Node);
     if (Mdl) {
         if (MmGetMdlByteCount(Mdl) == Size) {
             goto done;
@@ -170,7 +178,7 @@ __AllocPagesForMdl(
 
     // try anywhere
     LowAddr.QuadPart = 0ull;
-    Mdl = MmAllocatePagesForMdlEx(LowAddr, HighAddr, SkipBytes, Size, MmCached, 0);
+    Mdl = NumaAllocatePagesForMdl(LowAddr, HighAddr, SkipBytes, Size, Node);
     // Mdl byte count gets checked again after this returns
 
 done:
@@ -181,12 +189,13 @@ ___AllocPages(
     IN  PCHAR           Caller, 
     IN  ULONG           Line,
     IN  SIZE_T          Size,
+    IN  ULONG           Node,
     OUT PMDL*           Mdl
     )
 {
     PVOID               Buffer;
 
-    *Mdl = __AllocPagesForMdl(Size);
+    *Mdl = __AllocPagesForMdl(Size, Node);
     if (*Mdl == NULL) {
         Warning("%s:%u : MmAllocatePagesForMdlEx Failed %d bytes\n", Caller, Line, Size);
         goto fail1;
@@ -213,7 +222,8 @@ fail1:
     *Mdl = NULL;
     return NULL;
 }
-#define __AllocPages(Size, Mdl) ___AllocPages(__FUNCTION__, __LINE__, Size, Mdl)
+#define __AllocPages(Size, Mdl) ___AllocPages(__FUNCTION__, __LINE__, Size, XENVBD_NUMA_ANY_NODE, Mdl)
+#define __AllocNodePages(Size, Node, Mdl) ___AllocPages(__FUNCTION__, __LINE__, Size, Node, Mdl)
 
 static FORCEINLINE VOID
 __FreePages(
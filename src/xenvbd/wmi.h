@@ -0,0 +1,136 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, 
+ * with or without modification, are permitted provided 
+ * that the following conditions are met:
+ * 
+ * *   Redistributions of source code must retain the above 
+ *     copyright notice, this list of conditions and the 
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above 
+ *     copyright notice, this list of conditions and the 
+ *     following disclaimer in the documentation and/or other 
+ *     materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND 
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF 
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR 
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF 
+ * SUCH DAMAGE.
+ */ 
+
+#ifndef _XENVBD_WMI_H
+#define _XENVBD_WMI_H
+
+#include <ntddk.h>
+
+// {7B1B4C2E-2D0A-4F4B-9C55-5D1F2B7A0E01}
+DEFINE_GUID(GUID_XENVBD_WMI_ADAPTER_STATS,
+0x7b1b4c2e, 0x2d0a, 0x4f4b, 0x9c, 0x55, 0x5d, 0x1f, 0x2b, 0x7a, 0x0e, 0x01);
+
+// {7B1B4C2E-2D0A-4F4B-9C55-5D1F2B7A0E02}
+DEFINE_GUID(GUID_XENVBD_WMI_TARGET_STATS,
+0x7b1b4c2e, 0x2d0a, 0x4f4b, 0x9c, 0x55, 0x5d, 0x1f, 0x2b, 0x7a, 0x0e, 0x02);
+
+// {7B1B4C2E-2D0A-4F4B-9C55-5D1F2B7A0E03}
+DEFINE_GUID(GUID_XENVBD_WMI_TARGET_OUTLIERS,
+0x7b1b4c2e, 0x2d0a, 0x4f4b, 0x9c, 0x55, 0x5d, 0x1f, 0x2b, 0x7a, 0x0e, 0x03);
+
+// Data blocks published through StorPort's WMI support, described to WMI by
+// xenvbd.mof. All counters are monotonic from adapter/target creation,
+// consumers should sample and diff
+
+// Layout of every block below, reported in XENVBD_WMI_ADAPTER_STATS.Version.
+// Bump it (and update xenvbd.mof) whenever a block changes
+//  1 - initial layout
+//  2 - data path memory counters, outlier Outstanding flag
+#define XENVBD_WMI_VERSION      2
+
+typedef struct _XENVBD_WMI_ADAPTER_STATS {
+    ULONG               Targets;
+    ULONG               CurrentSrbs;
+    ULONG               MaximumSrbs;    // sampled at query time, not exact
+    ULONG               Version;        // XENVBD_WMI_VERSION
+    ULONG64             TotalSrbs;
+
+    // data path memory, MemoryBudget is 0 when there is no limit
+    ULONG64             MemoryUsed;
+    ULONG64             MemoryMaximum;
+    ULONG64             MemoryBudget;
+    ULONG64             MemoryRefused;
+} XENVBD_WMI_ADAPTER_STATS, *PXENVBD_WMI_ADAPTER_STATS;
+
+// one instance per target id, Present is 0 for unused target ids
+typedef struct _XENVBD_WMI_TARGET_STATS {
+    ULONG               TargetId;
+    ULONG               Present;
+
+    ULONG64             BlkOpRead;
+    ULONG64             BlkOpWrite;
+    ULONG64             BlkOpIndirectRead;
+    ULONG64             BlkOpIndirectWrite;
+    ULONG64             BlkOpBarrier;
+    ULONG64             BlkOpDiscard;
+    ULONG64             BytesRead;
+    ULONG64             BytesWritten;
+
+    ULONG64             SegsGranted;
+    ULONG64             SegsBounced;
+    ULONG64             FailedMaps;
+    ULONG64             FailedBounces;
+    ULONG64             FailedGrants;
+    ULONG64             RingFull;
+
+    ULONG               FreshSrbs;
+    ULONG               FreshSrbsMaximum;
+    ULONG               PreparedReqs;
+    ULONG               PreparedReqsMaximum;
+    ULONG               SubmittedReqs;
+    ULONG               SubmittedReqsMaximum;
+
+    ULONG64             MemoryUsed;
+    ULONG64             MemoryCredit;
+    ULONG64             MemoryRefused;
+} XENVBD_WMI_TARGET_STATS, *PXENVBD_WMI_TARGET_STATS;
+
+// A request that took longer than DriverParameters.SlowThreshold
+typedef struct _XENVBD_OUTLIER {
+    ULONG64             Lba;            // first sector of the request
+    ULONG64             StartUs;        // StartIo, us since boot
+    ULONG64             QueueUs;        // StartIo to ring submission
+    ULONG64             DeviceUs;       // ring submission to response
+    ULONG               Tag;
+    ULONG               Length;         // bytes in the SRB
+    ULONG               RingIndex;      // req_prod at submission
+    USHORT              Segments;
+    USHORT              Bounced;
+    USHORT              BackendDomain;
+    UCHAR               Operation;      // BLKIF_OP_*
+    UCHAR               Indirect;
+    UCHAR               Outstanding;    // no response yet, DeviceUs so far
+    UCHAR               __Padding[3];
+} XENVBD_OUTLIER, *PXENVBD_OUTLIER;
+
+#define XENVBD_WMI_OUTLIERS     16      // power of 2
+
+// one instance per target id, the last XENVBD_WMI_OUTLIERS outliers
+typedef struct _XENVBD_WMI_TARGET_OUTLIERS {
+    ULONG               TargetId;
+    ULONG               Count;          // valid entries in Outliers
+    ULONG64             Sequence;       // outliers ever captured
+    ULONG               ThresholdMs;
+    ULONG               __Padding;
+    XENVBD_OUTLIER      Outliers[XENVBD_WMI_OUTLIERS];  // oldest first
+} XENVBD_WMI_TARGET_OUTLIERS, *PXENVBD_WMI_TARGET_OUTLIERS;
+
+#endif // _XENVBD_WMI_H